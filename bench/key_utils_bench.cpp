@@ -0,0 +1,87 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+#include "../detail/key_utils.hpp"
+
+using namespace merkle;
+
+namespace {
+
+// Pairs of keys that share a common prefix of random length. Key lengths are drawn uniformly from
+// [32, maxLength], which matches account (32 bytes) and storage (up to 128 bytes) paths.
+std::vector<std::pair<ByteSequence, ByteSequence>> makeKeyPairs(size_t maxLength) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> lengthDist(32, maxLength);
+    std::uniform_int_distribution<int> byteDist(0, 255);
+    std::vector<std::pair<ByteSequence, ByteSequence>> pairs;
+    for (int i = 0; i < 1024; ++i) {
+        auto length = lengthDist(gen);
+        ByteSequence lhs;
+        for (size_t j = 0; j < length; ++j) {
+            lhs.push_back(static_cast<Byte>(byteDist(gen)));
+        }
+        auto rhs = lhs;
+        auto mismatchPos = std::uniform_int_distribution<size_t>(0, length)(gen);
+        if (mismatchPos < length) {
+            rhs[mismatchPos] ^= 0xFF;
+        }
+        pairs.emplace_back(std::move(lhs), std::move(rhs));
+    }
+    return pairs;
+}
+
+size_t scalarMismatch(const Byte* lhs, const Byte* rhs, size_t size) {
+    size_t i = 0;
+    for (; i < size; ++i) {
+        if (lhs[i] != rhs[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+void BM_ScalarMismatch(benchmark::State& state) {
+    auto pairs = makeKeyPairs(state.range(0));
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& [lhs, rhs] = pairs[i++ & 1023];
+        benchmark::DoNotOptimize(scalarMismatch(lhs.data(), rhs.data(), lhs.size()));
+    }
+}
+
+void BM_FindMismatch(benchmark::State& state) {
+    auto pairs = makeKeyPairs(state.range(0));
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& [lhs, rhs] = pairs[i++ & 1023];
+        benchmark::DoNotOptimize(findMismatch(lhs.data(), rhs.data(), lhs.size()));
+    }
+}
+
+void BM_ExtensionCompareTo(benchmark::State& state) {
+    auto pairs = makeKeyPairs(state.range(0));
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& [lhs, rhs] = pairs[i++ & 1023];
+        benchmark::DoNotOptimize(ExtensionView{lhs}.compareTo(ByteSequenceToView(rhs)));
+    }
+}
+
+void BM_LessThan(benchmark::State& state) {
+    auto pairs = makeKeyPairs(state.range(0));
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& [lhs, rhs] = pairs[i++ & 1023];
+        benchmark::DoNotOptimize(LessThan{}(lhs, rhs));
+    }
+}
+
+}  // namespace
+
+BENCHMARK(BM_ScalarMismatch)->Arg(32)->Arg(64)->Arg(128);
+BENCHMARK(BM_FindMismatch)->Arg(32)->Arg(64)->Arg(128);
+BENCHMARK(BM_ExtensionCompareTo)->Arg(32)->Arg(64)->Arg(128);
+BENCHMARK(BM_LessThan)->Arg(32)->Arg(64)->Arg(128);
+
+BENCHMARK_MAIN();
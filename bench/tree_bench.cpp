@@ -0,0 +1,498 @@
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <random>
+#include <sstream>
+
+#include "../commit_pipeline.hpp"
+#include "../node_reader.hpp"
+#include "../proof.hpp"
+#include "../sharded_tree.hpp"
+#include "../tree.hpp"
+
+using namespace merkle;
+
+namespace {
+
+// Key shapes: uniformly random bytes, a big endian counter (sorted inserts) and keys sharing all
+// but their last 8 bytes (deep paths with long extensions).
+enum KeyShape { kRandom, kSequential, kSharedPrefix };
+
+std::vector<ByteSequence> makeKeys(KeyShape shape, size_t count, size_t length, uint32_t seed = 7) {
+    std::mt19937_64 gen(seed);
+    std::vector<ByteSequence> keys;
+    keys.reserve(count);
+    ByteSequence sharedPrefix(length > 8 ? length - 8 : 0);
+    for (auto& b : sharedPrefix) {
+        b = static_cast<Byte>(gen());
+    }
+    for (size_t i = 0; i < count; ++i) {
+        ByteSequence key(length);
+        switch (shape) {
+            case kRandom:
+                for (auto& b : key) {
+                    b = static_cast<Byte>(gen());
+                }
+                break;
+            case kSequential:
+                for (size_t j = 0; j < length && j < sizeof(i); ++j) {
+                    key[length - 1 - j] = static_cast<Byte>(i >> (8 * j));
+                }
+                break;
+            case kSharedPrefix:
+                std::copy(sharedPrefix.begin(), sharedPrefix.end(), key.begin());
+                for (size_t j = sharedPrefix.size(); j < length; ++j) {
+                    key[j] = static_cast<Byte>(gen());
+                }
+                break;
+        }
+        keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+Tree makeTree(const std::vector<ByteSequence>& keys) {
+    Tree tree;
+    for (const auto& key : keys) {
+        tree.insert(ByteSequence{key}, ByteSequence{'v', 'a', 'l'});
+    }
+    tree.calculateHash();
+    return tree;
+}
+
+// Args: tree size, key length.
+template <KeyShape shape>
+void BM_Insert(benchmark::State& state) {
+    auto keys = makeKeys(shape, state.range(0), state.range(1));
+    for (auto _ : state) {
+        state.PauseTiming();
+        Tree tree;
+        auto copies = keys;
+        state.ResumeTiming();
+        for (auto& key : copies) {
+            tree.insert(std::move(key), ByteSequence{'v', 'a', 'l'});
+        }
+        benchmark::DoNotOptimize(tree.getRootNode().get());
+        // destroying the tree is not part of the measurement
+        state.PauseTiming();
+        {
+            auto discard = std::move(tree);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Same as BM_Insert<kRandom> through the view overload, keys and values are not copied.
+void BM_InsertViews(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), state.range(1));
+    const ByteSequence value{'v', 'a', 'l'};
+    for (auto _ : state) {
+        state.PauseTiming();
+        Tree tree;
+        state.ResumeTiming();
+        for (const auto& key : keys) {
+            tree.insert(ByteSequenceView{key}, ByteSequenceView{value});
+        }
+        benchmark::DoNotOptimize(tree.getRootNode().get());
+        state.PauseTiming();
+        {
+            auto discard = std::move(tree);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Args: tree size, number of keys updated before the commit.
+void BM_CalculateHash(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), 32);
+    auto tree = makeTree(keys);
+    std::mt19937 gen(3);
+    Byte round = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        ++round;
+        for (int64_t i = 0; i < state.range(1); ++i) {
+            tree.insert(ByteSequence{keys[gen() % keys.size()]}, ByteSequence{'v', round});
+        }
+        state.ResumeTiming();
+        tree.calculateHash();
+    }
+    state.counters["dirty_nodes"] = static_cast<double>(tree.numDirtynodes_);
+}
+
+// A block of updates concentrated on a few hot keys followed by a commit. Args: tree size, number
+// of hot keys, updates per block.
+template <Tree::LeafHashing leafHashing>
+void BM_HotKeyBlock(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), 32);
+    Tree tree(leafHashing);
+    for (const auto& key : keys) {
+        tree.insert(ByteSequence{key}, ByteSequence{'v', 'a', 'l'});
+    }
+    tree.calculateHash();
+    std::mt19937 gen(3);
+    Byte round = 0;
+    for (auto _ : state) {
+        ++round;
+        for (int64_t i = 0; i < state.range(2); ++i) {
+            tree.insert(ByteSequence{keys[gen() % state.range(1)]}, ByteSequence{'v', round});
+        }
+        tree.calculateHash();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(2));
+}
+
+// A block of writes of the values the keys already have followed by a commit, on a tree that
+// applies them or skips them. Args: tree size, writes per block, skip.
+void BM_UnchangedWrites(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), 32);
+    const ByteSequence value{'v', 'a', 'l'};
+    Tree tree(Tree::LeafHashing::eager,
+              state.range(2) ? Tree::UnchangedWrites::skip : Tree::UnchangedWrites::apply);
+    for (const auto& key : keys) {
+        tree.insert(ByteSequenceView{key}, ByteSequenceView{value});
+    }
+    tree.calculateHash();
+    std::mt19937 gen(5);
+    for (auto _ : state) {
+        for (int64_t i = 0; i < state.range(1); ++i) {
+            tree.insert(ByteSequenceView{keys[gen() % keys.size()]}, ByteSequenceView{value});
+        }
+        tree.calculateHash();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+// A block of random updates followed by a commit on a 2^14 keys tree of each branch hashing.
+// Args: branch hashing, updates per block.
+void BM_BranchHashingCommit(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, 1 << 14, 32);
+    Tree tree(static_cast<Tree::BranchHashing>(state.range(0)));
+    for (const auto& key : keys) {
+        tree.insert(ByteSequence{key}, ByteSequence{'v', 'a', 'l'});
+    }
+    tree.calculateHash();
+    std::mt19937 gen(3);
+    Byte round = 0;
+    for (auto _ : state) {
+        ++round;
+        for (int64_t i = 0; i < state.range(1); ++i) {
+            tree.insert(ByteSequence{keys[gen() % keys.size()]}, ByteSequence{'v', round});
+        }
+        tree.calculateHash();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+
+// Generating and verifying the proof of a random key of a 2^14 keys tree, a Proof for flat and a
+// PathProof for binary and radix16. Args: branch hashing.
+void BM_ProveKey(benchmark::State& state) {
+    auto branchHashing = static_cast<Tree::BranchHashing>(state.range(0));
+    auto keys = makeKeys(kRandom, 1 << 14, 32);
+    Tree tree(branchHashing);
+    const ByteSequence value{'v', 'a', 'l'};
+    for (const auto& key : keys) {
+        tree.insert(ByteSequence{key}, ByteSequence{value});
+    }
+    tree.calculateHash();
+    const auto* rootHash = tree.getRootNode()->hash();
+    std::mt19937 gen(3);
+    size_t proofBytes = 0;
+    for (auto _ : state) {
+        const auto& key = keys[gen() % keys.size()];
+        KeyValueView kv{key, value};
+        if (branchHashing == Tree::BranchHashing::flat) {
+            auto proof = generateProof(tree, key);
+            proofBytes += proof.byteSize();
+            benchmark::DoNotOptimize(verifyProof(rootHash, proof, std::span{&kv, 1}));
+        } else {
+            auto proof = generatePathProof(tree, key);
+            proofBytes += proof->byteSize();
+            benchmark::DoNotOptimize(verifyPathProof(rootHash, *proof, kv, branchHashing));
+        }
+    }
+    state.counters["proof_bytes"] =
+        benchmark::Counter(static_cast<double>(proofBytes), benchmark::Counter::kAvgIterations);
+}
+
+// Single key proofs over a 2^14 keys tree, checked one by one with verifyProof (threads = 0) or
+// as one verifyProofs batch. Args: number of proofs, threads.
+void BM_VerifyProofs(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, 1 << 14, 32);
+    auto tree = makeTree(keys);
+    const ByteSequence value{'v', 'a', 'l'};
+    std::vector<Proof> proofs;
+    std::vector<ProofItem> items;
+    proofs.reserve(state.range(0));
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        proofs.push_back(generateProof(tree, keys[i]));
+    }
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        items.push_back(ProofItem{keys[i], value, &proofs[i]});
+    }
+    const auto* rootHash = tree.getRootNode()->hash();
+    for (auto _ : state) {
+        if (state.range(1) == 0) {
+            for (const auto& item : items) {
+                KeyValueView kv{item.key, item.value};
+                benchmark::DoNotOptimize(verifyProof(rootHash, *item.proof, std::span{&kv, 1}));
+            }
+        } else {
+            benchmark::DoNotOptimize(verifyProofs(rootHash, items, state.range(1)));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Multi-proofs of random keys read from a node log of a 2^14 keys tree, with as many reads in
+// flight per level as reader threads. Args: keys per proof, reader threads.
+void BM_MultiProofFromLog(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, 1 << 14, 32);
+    auto tree = makeTree(keys);
+    auto path = std::filesystem::temp_directory_path() /
+                ("kvmerkle_bench_" + std::to_string(::getpid()) + ".log");
+    std::filesystem::remove(path);
+    {
+        NodeLog log(path.string());
+        log.commit(tree, 1);
+        AsyncNodeReader reader(log, state.range(1));
+        std::vector<ByteSequence> proofKeys(keys.begin(), keys.begin() + state.range(0));
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(generateMultiProof(reader, 1, proofKeys));
+        }
+    }
+    std::filesystem::remove(path);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// A branch node as found in a tree. Args: number of children, extension length.
+std::unique_ptr<BranchNode> makeBranchNode(size_t numChildren, size_t extensionLength) {
+    auto node = BranchNode::createBranchNode();
+    node->setExtension(ByteSequence(extensionLength, 'e'));
+    for (size_t i = 0; i < numChildren; ++i) {
+        std::unique_ptr<Node> child;
+        if (i % 2 == 0) {
+            child = HashOfLeaf::createhashOfLeaf(ByteSequence(32, static_cast<Byte>(i)),
+                                                 ByteSequence{'v'}, ByteSequence(31 - i % 32, 'x'));
+        } else {
+            child = std::make_unique<HashOfBranch>();
+            child->setExtension(ByteSequence(i % 8, 'x'));
+        }
+        node->swapNodeAtChild(static_cast<Byte>(i * BranchNode::kBranchingFactor / numChildren),
+                              child);
+    }
+    node->computeHash();
+    return node;
+}
+
+void BM_BranchNodeSerialize(benchmark::State& state) {
+    auto node = makeBranchNode(state.range(0), state.range(1));
+    ByteSequence out;
+    for (auto _ : state) {
+        out.clear();
+        node->serialize(out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * out.size());
+}
+
+void BM_BranchNodeDeserialize(benchmark::State& state) {
+    auto node = makeBranchNode(state.range(0), state.range(1));
+    ByteSequence serialized;
+    node->serialize(serialized);
+    for (auto _ : state) {
+        auto deserialized = BranchNode::deserialize(serialized);
+        benchmark::DoNotOptimize(deserialized.get());
+    }
+    state.SetBytesProcessed(state.iterations() * serialized.size());
+}
+
+// Args: key length, the compared keys share a prefix of random length.
+void BM_ExtensionCompareTo(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, 1024, state.range(0));
+    auto others = keys;
+    std::mt19937 gen(5);
+    for (auto& other : others) {
+        auto pos = gen() % (other.size() + 1);
+        if (pos < other.size()) {
+            other[pos] ^= 0xFF;
+        }
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        auto idx = i++ & 1023;
+        benchmark::DoNotOptimize(
+            ExtensionView{keys[idx]}.compareTo(ByteSequenceToView(others[idx])));
+    }
+}
+
+// Args: tree size, key length.
+void BM_GetBranchNode(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), state.range(1));
+    auto tree = makeTree(keys);
+    std::vector<ByteSequence> dbKeys;
+    tree.forEachBranchNode([&dbKeys](ByteSequenceView key, const BranchNode&) {
+        dbKeys.emplace_back(key.begin(), key.end());
+    });
+    std::shuffle(dbKeys.begin(), dbKeys.end(), std::mt19937(9));
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& dbKey = dbKeys[i++ % dbKeys.size()];
+        benchmark::DoNotOptimize(tree.getBranchNode(dbKey).get());
+    }
+    state.counters["db_size"] = static_cast<double>(tree.dbSize());
+}
+
+// Lookups of shuffled keys, half of them absent, one find at a time (group = 0) or through
+// findBatch. Args: tree size, group.
+void BM_FindBatch(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), 32);
+    auto tree = makeTree(keys);
+    auto misses = makeKeys(kRandom, state.range(0), 32, 8);
+    keys.insert(keys.end(), misses.begin(), misses.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(9));
+    std::vector<ByteSequenceView> views(keys.begin(), keys.end());
+    std::vector<Tree::LookupResult> results(views.size());
+    for (auto _ : state) {
+        if (state.range(1) == 0) {
+            for (size_t i = 0; i < views.size(); ++i) {
+                results[i] = tree.find(views[i]);
+            }
+        } else {
+            tree.findBatch(views, results, state.range(1));
+        }
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed(state.iterations() * views.size());
+}
+
+// Inserts and a commit into a ShardedTree, writers splitting the shards between them. Args: number
+// of keys, writers.
+void BM_ShardedInsert(benchmark::State& state) {
+    auto keys = makeKeys(kRandom, state.range(0), 32);
+    const ByteSequence value{'v', 'a', 'l'};
+    auto writers = static_cast<size_t>(state.range(1));
+    for (auto _ : state) {
+        ShardedTree tree(Tree::LeafHashing::eager, writers);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < writers; ++w) {
+            threads.emplace_back([&, w] {
+                for (const auto& key : keys) {
+                    if (key[0] % writers == w) {
+                        tree.insert(ByteSequenceView{key}, ByteSequenceView{value});
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        benchmark::DoNotOptimize(tree.calculateHash());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Blocks of random writes over a 2^16 keys tree, each block inserted and committed before the next
+// (pipelined = 0) or through a CommitPipeline. Args: block size, pipelined.
+void BM_CommitBlocks(benchmark::State& state) {
+    constexpr size_t kBlocks = 16;
+    auto keys = makeKeys(kRandom, 1 << 16, 32);
+    auto blockKeys = makeKeys(kRandom, kBlocks * state.range(0), 32, 11);
+    const ByteSequence value{'v', 'a', 'l'};
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = makeTree(keys);
+        state.ResumeTiming();
+        if (state.range(1) == 0) {
+            for (size_t i = 0; i < blockKeys.size(); ++i) {
+                tree.insert(ByteSequenceView{blockKeys[i]}, ByteSequenceView{value});
+                if ((i + 1) % state.range(0) == 0) {
+                    tree.calculateHash();
+                }
+            }
+        } else {
+            CommitPipeline pipeline(tree);
+            for (size_t i = 0; i < blockKeys.size(); ++i) {
+                pipeline.insert(blockKeys[i], value);
+                if ((i + 1) % state.range(0) == 0) {
+                    pipeline.commitBlock();
+                }
+            }
+            pipeline.wait();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * blockKeys.size());
+}
+
+// Imports a snapshot of a tree of random 32 byte keys from memory, the hash checks on the calling
+// thread (threads = 0) or on a pool. Rebuilding from the key values instead is BM_Insert. Args:
+// number of keys, threads.
+void BM_ImportSnapshot(benchmark::State& state) {
+    auto tree = makeTree(makeKeys(kRandom, state.range(0), 32));
+    std::ostringstream out;
+    if (!tree.exportSnapshot(out)) {
+        state.SkipWithError("tree not committed");
+        return;
+    }
+    auto snapshot = out.str();
+    std::unique_ptr<ThreadPool> pool;
+    if (state.range(1) > 0) {
+        pool = std::make_unique<ThreadPool>(state.range(1));
+    }
+    for (auto _ : state) {
+        std::istringstream in(snapshot);
+        auto copy = Tree::importSnapshot(in, Tree::LeafHashing::eager, pool.get());
+        benchmark::DoNotOptimize(copy.has_value());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * snapshot.size());
+}
+
+}  // namespace
+
+BENCHMARK(BM_Insert<kRandom>)
+    ->Name("BM_Insert/random")
+    ->ArgsProduct({{1 << 10, 1 << 14, 1 << 17}, {32, 64, 128}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Insert<kSequential>)
+    ->Name("BM_Insert/sequential")
+    ->ArgsProduct({{1 << 10, 1 << 14, 1 << 17}, {32, 64, 128}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Insert<kSharedPrefix>)
+    ->Name("BM_Insert/shared_prefix")
+    ->ArgsProduct({{1 << 10, 1 << 14, 1 << 17}, {32, 64, 128}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_InsertViews)->ArgsProduct({{1 << 10, 1 << 14}, {32, 128}});
+BENCHMARK(BM_CalculateHash)
+    ->ArgsProduct({{1 << 14, 1 << 17}, {1, 64, 1024}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_HotKeyBlock<Tree::LeafHashing::eager>)->Args({1 << 14, 16, 1 << 10});
+BENCHMARK(BM_HotKeyBlock<Tree::LeafHashing::deferred>)->Args({1 << 14, 16, 1 << 10});
+BENCHMARK(BM_UnchangedWrites)->ArgsProduct({{1 << 14}, {1 << 10}, {0, 1}});
+BENCHMARK(BM_BranchHashingCommit)->ArgsProduct({{0, 1, 2}, {1, 1 << 10}});
+BENCHMARK(BM_ProveKey)->DenseRange(0, 2);
+BENCHMARK(BM_VerifyProofs)->ArgsProduct({{1 << 12}, {0, 1, 4}})->UseRealTime();
+BENCHMARK(BM_MultiProofFromLog)->ArgsProduct({{64, 1024}, {1, 16}})->UseRealTime();
+BENCHMARK(BM_FindBatch)
+    ->ArgsProduct({{1 << 14, 1 << 18}, {0, 4, 16, 32}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ShardedInsert)
+    ->ArgsProduct({{1 << 16}, {1, 4}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CommitBlocks)
+    ->ArgsProduct({{1 << 10, 1 << 12}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ImportSnapshot)
+    ->ArgsProduct({{1 << 14, 1 << 17}, {0, 4}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BranchNodeSerialize)->ArgsProduct({{2, 16, 256}, {0, 32}});
+BENCHMARK(BM_BranchNodeDeserialize)->ArgsProduct({{2, 16, 256}, {0, 32}});
+BENCHMARK(BM_ExtensionCompareTo)->Arg(32)->Arg(64)->Arg(128);
+BENCHMARK(BM_GetBranchNode)->ArgsProduct({{1 << 10, 1 << 14, 1 << 17}, {32, 128}});
+
+BENCHMARK_MAIN();
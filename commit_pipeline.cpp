@@ -0,0 +1,85 @@
+#include "commit_pipeline.hpp"
+
+namespace merkle {
+
+CommitPipeline::CommitPipeline(Tree& tree, size_t hashThreads)
+    : tree_(tree), hashPool_(hashThreads), committer_(1) {}
+
+void CommitPipeline::insert(ByteSequenceView key, ByteSequenceView value) {
+    RootHash leafHash;
+    HashOfLeaf::computeHash(key, value, leafHash.data());
+    auto itr = open_.find(key);
+    if (itr != open_.end()) {
+        itr->second = leafHash;
+        return;
+    }
+    open_.emplace(ByteSequence{key.begin(), key.end()}, leafHash);
+}
+
+Tree::LookupResult CommitPipeline::find(ByteSequenceView key) const {
+    Tree::LookupResult lookup;
+    auto fromOverlay = [&lookup, key](const Overlay& overlay) {
+        auto itr = overlay.find(key);
+        if (itr == overlay.end()) {
+            return false;
+        }
+        lookup.found = true;
+        std::memcpy(lookup.leafHash, itr->second.data(), SHA256_DIGEST_LENGTH);
+        return true;
+    };
+    if (fromOverlay(open_)) {
+        return lookup;
+    }
+    {
+        std::lock_guard lock(sealedMutex_);
+        for (auto itr = sealed_.rbegin(); itr != sealed_.rend(); ++itr) {
+            if (fromOverlay(**itr)) {
+                return lookup;
+            }
+        }
+    }
+    // a block leaves sealed_ only once it is in the tree
+    std::lock_guard lock(treeMutex_);
+    return tree_.find(key);
+}
+
+std::shared_future<CommitPipeline::RootHash> CommitPipeline::commitBlock() {
+    auto block = std::make_shared<const Overlay>(std::move(open_));
+    open_.clear();
+    {
+        std::lock_guard lock(sealedMutex_);
+        sealed_.push_back(block);
+    }
+    lastCommit_ = committer_.submit([this, block] { return commit(*block); }).share();
+    return lastCommit_;
+}
+
+void CommitPipeline::wait() {
+    if (lastCommit_.valid()) {
+        lastCommit_.wait();
+    }
+}
+
+size_t CommitPipeline::blocksInFlight() const {
+    std::lock_guard lock(sealedMutex_);
+    return sealed_.size();
+}
+
+CommitPipeline::RootHash CommitPipeline::commit(const Overlay& block) {
+    std::lock_guard treeLock(treeMutex_);
+    for (const auto& [key, leafHash] : block) {
+        tree_.insertLeafHash(key, leafHash.data());
+    }
+    {
+        std::lock_guard lock(sealedMutex_);
+        sealed_.pop_front();
+    }
+    // the levels of the dirty set are hashed across the pool
+    tree_.calculateHash(hashPool_);
+    const auto& root = tree_.getRootNode();
+    RootHash rootHash;
+    std::memcpy(rootHash.data(), root->hash(), SHA256_DIGEST_LENGTH);
+    return rootHash;
+}
+
+};  // namespace merkle
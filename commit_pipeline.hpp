@@ -0,0 +1,62 @@
+#include <array>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "detail/thread_pool.hpp"
+#include "tree.hpp"
+
+#pragma once
+
+namespace merkle {
+
+// Overlaps the commit of a block with the inserts of the next one. Inserts go into an overlay of
+// the open block, with their leaf hashed right away. commitBlock seals the overlay and hands it to
+// a committer thread that applies the leaf hashes to the tree and commits it, hashing each level of
+// the dirty nodes across hashThreads threads, while a fresh overlay takes the next block.
+// Blocks are committed in the order they were sealed.
+//
+// insert, find and commitBlock are meant to be called from a single thread. The tree must not be
+// touched directly while the pipeline has blocks in flight, see wait.
+class CommitPipeline {
+   public:
+    using RootHash = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+    explicit CommitPipeline(Tree& tree, size_t hashThreads = std::thread::hardware_concurrency());
+    ~CommitPipeline() { wait(); }
+    CommitPipeline(const CommitPipeline&) = delete;
+    CommitPipeline& operator=(const CommitPipeline&) = delete;
+
+    void insert(ByteSequenceView key, ByteSequenceView value);
+    // The newest write of key, from the open block, a sealed block still in flight or the tree.
+    // Only found and leafHash are set when the key comes from an overlay.
+    Tree::LookupResult find(ByteSequenceView key) const;
+
+    // Seals the open block and returns the root hash the tree gets once the block is committed.
+    std::shared_future<RootHash> commitBlock();
+    // Waits until every sealed block is committed, the open block stays open.
+    void wait();
+    size_t openBlockSize() const { return open_.size(); }
+    size_t blocksInFlight() const;
+
+   private:
+    // leaf hash by key, the newest write wins
+    using Overlay = std::map<ByteSequence, RootHash, LessThan>;
+
+    RootHash commit(const Overlay& block);
+
+    Tree& tree_;
+    Overlay open_;
+    // sealed blocks not yet applied to the tree, oldest first
+    mutable std::mutex sealedMutex_;
+    std::deque<std::shared_ptr<const Overlay>> sealed_;
+    // held by the committer while it changes the tree
+    mutable std::mutex treeMutex_;
+    std::shared_future<RootHash> lastCommit_;
+    ThreadPool hashPool_;
+    // a single thread, so blocks are committed in order
+    ThreadPool committer_;
+};
+
+};  // namespace merkle
@@ -0,0 +1,147 @@
+#include "compactor.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "detail/file_io.hpp"
+#include "detail/throttle.hpp"
+
+namespace merkle {
+
+namespace {
+
+// copies are batched into writes of about this size
+constexpr size_t kWriteBatchBytes = 1 << 20;
+
+// compactions of any log are serialized, they are rare and mostly bound by the disk anyway
+std::mutex compactionMutex;
+
+}  // namespace
+
+CompactionResult compact(NodeLog& log, uint64_t writeBytesPerSecond) {
+    std::lock_guard compactionLock(compactionMutex);
+    CompactionResult result;
+    NodeLog::Index snapshot;
+    uint64_t watermark = 0;
+    {
+        std::lock_guard lock(log.mutex_);
+        snapshot = log.index_;
+        watermark = log.fileBytes_;
+    }
+
+    auto compactPath = log.path_ + ".compact";
+    int fd = ::open(compactPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throwErrno("compact open " + compactPath);
+    }
+    try {
+        // Copy the snapshot in db key order. Records below the watermark are never rewritten in
+        // place, so they can be read without holding the log's locks.
+        Throttle throttle(writeBytesPerSecond);
+        std::unordered_map<uint64_t, uint64_t> newOffsets;
+        // old offset and record size, in the order of the new file
+        std::vector<std::pair<uint64_t, uint64_t>> copied;
+        ByteSequence batch;
+        uint64_t written = 0;
+        auto flush = [&] {
+            writeAll(fd, batch.data(), batch.size(), written);
+            throttle.consume(batch.size());
+            written += batch.size();
+            batch.clear();
+        };
+        for (const auto& [dbKey, versions] : snapshot) {
+            for (const auto& [version, location] : versions) {
+                newOffsets.emplace(location.offset, written + batch.size());
+                copied.emplace_back(location.offset, location.recordSize());
+                auto batchSize = batch.size();
+                batch.resize(batchSize + location.recordSize());
+                readAll(log.fd_, batch.data() + batchSize, location.recordSize(), location.offset);
+                if (batch.size() >= kWriteBatchBytes) {
+                    flush();
+                }
+            }
+        }
+        flush();
+
+        std::unique_lock fileLock(log.fileMutex_);
+        std::lock_guard lock(log.mutex_);
+        result.bytesBefore = log.fileBytes_;
+
+        // The pruner may have dropped records since the snapshot. Their copies are squeezed out
+        // of the new file, else they would come back when the log is reopened. The pruner and
+        // the compactor rarely overlap, so this mostly finds nothing to do.
+        std::unordered_set<uint64_t> live;
+        for (const auto& [dbKey, versions] : log.index_) {
+            for (const auto& [version, location] : versions) {
+                if (location.offset < watermark) {
+                    live.insert(location.offset);
+                }
+            }
+        }
+        if (live.size() < copied.size()) {
+            written = 0;
+            for (const auto& [offset, size] : copied) {
+                if (live.count(offset) == 0) {
+                    continue;
+                }
+                auto& newOffset = newOffsets.at(offset);
+                if (newOffset != written) {
+                    // records only move towards the front, so nothing is read after overwritten
+                    batch.resize(size);
+                    readAll(fd, batch.data(), size, newOffset);
+                    writeAll(fd, batch.data(), size, written);
+                    newOffset = written;
+                }
+                written += size;
+            }
+            batch.clear();
+            if (::ftruncate(fd, static_cast<off_t>(written)) != 0) {
+                throwErrno("compact truncate " + compactPath);
+            }
+        }
+        result.recordsRewritten = live.size();
+
+        // the records committed since the snapshot go after the rewritten ones, as they are
+        auto tailStart = written;
+        batch.resize(log.fileBytes_ - watermark);
+        readAll(log.fd_, batch.data(), batch.size(), watermark);
+        flush();
+        if (::fsync(fd) != 0) {
+            throwErrno("compact fsync " + compactPath);
+        }
+
+        if (::rename(compactPath.c_str(), log.path_.c_str()) != 0) {
+            throwErrno("compact rename " + compactPath);
+        }
+        auto generation = log.generation_ + 1;
+        uint64_t liveBytes = 0;
+        for (auto& [dbKey, versions] : log.index_) {
+            for (auto& [version, location] : versions) {
+                if (location.offset < watermark) {
+                    location.offset = newOffsets.at(location.offset);
+                } else {
+                    location.offset = location.offset - watermark + tailStart;
+                    ++result.recordsCarried;
+                }
+                location.generation = generation;
+                liveBytes += location.recordSize();
+            }
+        }
+        ::close(log.fd_);
+        log.fd_ = fd;
+        log.generation_ = generation;
+        log.fileBytes_ = written;
+        log.liveBytes_ = liveBytes;
+        result.bytesAfter = written;
+    } catch (...) {
+        ::close(fd);
+        ::unlink(compactPath.c_str());
+        throw;
+    }
+    // the swap is in place either way, a crash before the directory is synced may bring back the
+    // old file
+    syncParentDirectory(log.path_);
+    return result;
+}
+
+};  // namespace merkle
@@ -0,0 +1,31 @@
+#include "node_log.hpp"
+
+#pragma once
+
+namespace merkle {
+
+struct CompactionResult {
+    // file sizes at the swap, so the records committed during the compaction count in both
+    uint64_t bytesBefore = 0;
+    uint64_t bytesAfter = 0;
+    // live records rewritten in db key order, and records committed during the compaction that
+    // were carried over as they are
+    size_t recordsRewritten = 0;
+    size_t recordsCarried = 0;
+
+    uint64_t bytesReclaimed() const { return bytesBefore - bytesAfter; }
+};
+
+// Rewrites the live records of log into a new file in db key order, which is the depth first
+// order of the tree, so a branch node and its subtree end up next to each other and a prefix scan
+// or a proof reads the file mostly forward. The versions of a db key stay together.
+//
+// Commits, reads and pruning go on while the records are copied, paced to writeBytesPerSecond (0
+// for no limit). At the end the records committed meanwhile are appended to the new file, which
+// then atomically replaces the old one by rename, along with the index. Records pruned meanwhile
+// are dropped from the new file before the swap. Locations taken before that are stale, see
+// NodeLog::readNode. The new file and then its directory are synced, so the swap survives a
+// crash once compact returns. Compactions run one at a time.
+CompactionResult compact(NodeLog& log, uint64_t writeBytesPerSecond = 0);
+
+};  // namespace merkle
@@ -0,0 +1,68 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+#pragma once
+
+namespace merkle {
+
+[[noreturn]] inline void throwErrno(const std::string& what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// pread and pwrite until all the bytes are transferred, throw std::system_error on failure or
+// on reading past the end of the file.
+inline void readAll(int fd, void* out, uint64_t size, uint64_t offset) {
+    auto* pOut = static_cast<uint8_t*>(out);
+    while (size > 0) {
+        auto n = ::pread(fd, pOut, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throwErrno("read");
+        }
+        pOut += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+inline void writeAll(int fd, const void* in, uint64_t size, uint64_t offset) {
+    const auto* pIn = static_cast<const uint8_t*>(in);
+    while (size > 0) {
+        auto n = ::pwrite(fd, pIn, size, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throwErrno("write");
+        }
+        pIn += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+// fsync the directory holding path, a file created in it or renamed into it is durable only then
+inline void syncParentDirectory(const std::string& path) {
+    auto slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throwErrno("open " + dir);
+    }
+    if (::fsync(fd) != 0) {
+        auto error = errno;
+        ::close(fd);
+        errno = error;
+        throwErrno("fsync " + dir);
+    }
+    ::close(fd);
+}
+
+};  // namespace merkle
@@ -1,5 +1,6 @@
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <optional>
 #include <span>
@@ -7,6 +8,8 @@
 #include <utility>
 #include <vector>
 
+#include "mismatch.hpp"
+
 #pragma once
 
 namespace merkle {
@@ -37,10 +40,10 @@ struct LessThan {
     using is_transparent = void;  // Enables heterogeneous lookup
     template <typename T, typename U>
     bool operator()(const T& lhs, const U& rhs) const {
-        for (size_t i = 0; i < lhs.size() && i < rhs.size(); ++i) {
-            if (lhs[i] != rhs[i]) {
-                return lhs[i] < rhs[i];
-            }
+        auto shorterSize = lhs.size() < rhs.size() ? lhs.size() : rhs.size();
+        auto i = findMismatch(lhs.data(), rhs.data(), shorterSize);
+        if (i < shorterSize) {
+            return lhs[i] < rhs[i];
         }
         return lhs.size() < rhs.size();
     }
@@ -50,12 +53,8 @@ struct CompareBytes {
     using is_transparent = void;  // Enables heterogeneous lookup
     template <typename T, typename U>
     bool operator()(const T& lhs, const U& rhs) const {
-        for (size_t i = 0; i < lhs.size() && i < rhs.size(); ++i) {
-            if (lhs[i] != rhs[i]) {
-                return false;
-            }
-        }
-        return lhs.size() == rhs.size();
+        return lhs.size() == rhs.size() &&
+               findMismatch(lhs.data(), rhs.data(), lhs.size()) == lhs.size();
     }
 };
 
@@ -72,7 +71,8 @@ class ExtensionView {
     size_t size() const { return extension.size(); }
     bool operator==(const ExtensionView& other) const {
         return extension.size() == other.extension.size() &&
-               std::equal(extension.begin(), extension.end(), other.extension.begin());
+               findMismatch(extension.data(), other.extension.data(), extension.size()) ==
+                   extension.size();
     }
 
     CompareResult compareTo(const ExtensionView& other) const {
@@ -124,6 +124,76 @@ class ExtensionView {
     size_t position = 0;
 };
 
+// 128 bit key of sipHash, draw it at random per process so that outsiders can't pick inputs
+// that collide.
+struct SipKey {
+    uint64_t k0 = 0;
+    uint64_t k1 = 0;
+};
+
+// SipHash-2-4, wide selects the 128 bit variant and sets high to its second word.
+inline uint64_t sipHashImpl(ByteSequenceView bytes, const SipKey& key, bool wide, uint64_t* high) {
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    uint64_t v0 = key.k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key.k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key.k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key.k1 ^ 0x7465646279746573ULL;
+    auto rounds = [&](int n) {
+        for (int i = 0; i < n; ++i) {
+            v0 += v1;
+            v1 = rotl(v1, 13) ^ v0;
+            v0 = rotl(v0, 32);
+            v2 += v3;
+            v3 = rotl(v3, 16) ^ v2;
+            v0 += v3;
+            v3 = rotl(v3, 21) ^ v0;
+            v2 += v1;
+            v1 = rotl(v1, 17) ^ v2;
+            v2 = rotl(v2, 32);
+        }
+    };
+    auto absorb = [&](uint64_t m) {
+        v3 ^= m;
+        rounds(2);
+        v0 ^= m;
+    };
+    if (wide) {
+        v1 ^= 0xee;
+    }
+    size_t pos = 0;
+    for (; pos + sizeof(uint64_t) <= bytes.size(); pos += sizeof(uint64_t)) {
+        uint64_t m;
+        std::memcpy(&m, bytes.data() + pos, sizeof(m));
+        absorb(m);
+    }
+    uint64_t last = static_cast<uint64_t>(bytes.size()) << 56;
+    for (size_t i = 0; pos + i < bytes.size(); ++i) {
+        last |= static_cast<uint64_t>(bytes[pos + i]) << (8 * i);
+    }
+    absorb(last);
+    v2 ^= wide ? 0xee : 0xff;
+    rounds(4);
+    auto low = v0 ^ v1 ^ v2 ^ v3;
+    if (wide) {
+        v1 ^= 0xdd;
+        rounds(4);
+        *high = v0 ^ v1 ^ v2 ^ v3;
+    }
+    return low;
+}
+
+// SipHash-2-4 is a keyed PRF, without the key its outputs can't be told from random and
+// collisions can't be crafted.
+inline uint64_t sipHash(ByteSequenceView bytes, const SipKey& key) {
+    return sipHashImpl(bytes, key, false, nullptr);
+}
+// The 128 bit variant, low and high word.
+inline std::pair<uint64_t, uint64_t> sipHash128(ByteSequenceView bytes, const SipKey& key) {
+    uint64_t high = 0;
+    auto low = sipHashImpl(bytes, key, true, &high);
+    return {low, high};
+}
+
 };  // namespace merkle
 
 namespace std {
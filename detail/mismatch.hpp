@@ -0,0 +1,45 @@
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#pragma once
+
+namespace merkle {
+
+// Returns the index of the first byte at which lhs and rhs differ, or size if the first size bytes
+// are equal. Keys are 32-128 bytes in practice so the bulk of the work is done 32 (AVX2) or 16
+// (SSE2) bytes at a time, the remaining bytes are compared one by one.
+inline size_t findMismatch(const uint8_t* lhs, const uint8_t* rhs, size_t size) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= size; i += 32) {
+        auto l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i));
+        auto r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i));
+        auto eqMask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, r)));
+        if (eqMask != 0xFFFFFFFFu) {
+            return i + __builtin_ctz(~eqMask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        auto l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        auto r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+        auto eqMask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(l, r)));
+        if (eqMask != 0xFFFFu) {
+            return i + __builtin_ctz(~eqMask);
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (lhs[i] != rhs[i]) {
+            return i;
+        }
+    }
+    return size;
+}
+
+};  // namespace merkle
@@ -0,0 +1,124 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+
+#pragma once
+
+// Hot path counters are on unless the build defines KVMERKLE_ENABLE_STATS=0, in which case they
+// compile to nothing.
+#ifndef KVMERKLE_ENABLE_STATS
+#define KVMERKLE_ENABLE_STATS 1
+#endif
+
+namespace merkle {
+
+inline constexpr bool kStatsEnabled = KVMERKLE_ENABLE_STATS != 0;
+
+// Relaxed atomic counter, readers get a recent value and writers never contend on ordering.
+// Copyable so that the structures holding it stay movable.
+class Counter {
+   public:
+    Counter() = default;
+    Counter(const Counter& other) : value_(other.load()) {}
+    Counter& operator=(const Counter& other) {
+        store(other.load());
+        return *this;
+    }
+
+    void add(uint64_t n = 1) {
+        if constexpr (kStatsEnabled) {
+            value_.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+    void store(uint64_t n) {
+        if constexpr (kStatsEnabled) {
+            value_.store(n, std::memory_order_relaxed);
+        }
+    }
+    uint64_t load() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<uint64_t> value_{0};
+};
+
+// Measures the time until it goes out of scope into a counter, in nanoseconds.
+class ScopedTimer {
+   public:
+    explicit ScopedTimer(Counter& nanos) : nanos_(nanos) {
+        if constexpr (kStatsEnabled) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+    ~ScopedTimer() {
+        if constexpr (kStatsEnabled) {
+            nanos_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count());
+        }
+    }
+
+   private:
+    Counter& nanos_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+struct TreeCounters {
+    Counter inserts;
+    // inserts skipped as the key's leaf already held their value
+    Counter unchangedWrites;
+    // node db lookups made by inserts
+    Counter insertDbLookups;
+    Counter leafHashes;
+    Counter commits;
+    // branch node hashes over all commits and in the last commit
+    Counter branchHashes;
+    Counter lastCommitBranchHashes;
+    // time in calculateHash, and the part of it spent hashing branch nodes, the rest is traversal
+    Counter commitNanos;
+    Counter commitHashNanos;
+};
+
+// Shape of a tree, collected by walking it.
+struct TreeStats {
+    size_t branchNodes = 0;
+    size_t leaves = 0;
+    // depth is the number of branch nodes above, i.e. the root is at depth 0
+    std::map<size_t, size_t> branchNodesByDepth;
+    std::map<size_t, size_t> leavesByDepth;
+    // occupied slots, the leaf slot included, per branch node
+    std::map<size_t, size_t> fanOut;
+    std::map<size_t, size_t> branchExtensionLengths;
+    std::map<size_t, size_t> leafExtensionLengths;
+    // serialized size of all branch nodes, root included
+    size_t branchNodeBytes = 0;
+
+    double bytesPerBranchNode() const {
+        return branchNodes == 0 ? 0 : static_cast<double>(branchNodeBytes) / branchNodes;
+    }
+};
+
+// bucket:count pairs, space separated
+inline void printHistogram(std::ostream& os, const std::map<size_t, size_t>& histogram) {
+    for (const auto& [bucket, count] : histogram) {
+        os << bucket << ":" << count << " ";
+    }
+}
+
+inline std::ostream& operator<<(std::ostream& os, const TreeStats& stats) {
+    os << "branch nodes " << stats.branchNodes << " leaves " << stats.leaves
+       << " bytes per branch node " << stats.bytesPerBranchNode() << "\n";
+    for (const auto& [name, histogram] :
+         {std::pair{"branch nodes by depth", &stats.branchNodesByDepth},
+          std::pair{"leaves by depth", &stats.leavesByDepth}, std::pair{"fan out", &stats.fanOut},
+          std::pair{"branch extension lengths", &stats.branchExtensionLengths},
+          std::pair{"leaf extension lengths", &stats.leafExtensionLengths}}) {
+        os << name << " ";
+        printHistogram(os, *histogram);
+        os << "\n";
+    }
+    return os;
+}
+
+};  // namespace merkle
@@ -0,0 +1,33 @@
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#pragma once
+
+namespace merkle {
+
+// Paces a consumer to a rate of units per second, e.g. bytes read by a background job, by
+// sleeping in consume once it gets ahead. A rate of 0 never waits.
+class Throttle {
+   public:
+    explicit Throttle(uint64_t perSecond = 0)
+        : perSecond_(perSecond), start_(std::chrono::steady_clock::now()) {}
+
+    void consume(uint64_t units) {
+        if (perSecond_ == 0) {
+            return;
+        }
+        consumed_ += units;
+        auto due = start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>(static_cast<double>(consumed_) /
+                                                              static_cast<double>(perSecond_)));
+        std::this_thread::sleep_until(due);
+    }
+
+   private:
+    uint64_t perSecond_;
+    uint64_t consumed_ = 0;
+    std::chrono::steady_clock::time_point start_;
+};
+
+};  // namespace merkle
@@ -0,0 +1,179 @@
+#include "diff.hpp"
+
+namespace merkle {
+
+namespace {
+
+// A slot in one of the trees, either a leaf, a branch node or empty.
+struct Entry {
+    const Node* node = nullptr;
+    // the full key of a leaf or the db key followed by the extension of a branch node
+    ByteSequence path;
+
+    bool isBranch() const { return node != nullptr && node->getType() == Node::BranchNode; }
+};
+
+class Differ {
+   public:
+    Differ(const Tree& from, const Tree& to, TreeDiff& out) : from_(from), to_(to), out_(out) {}
+
+    void run() {
+        out_.nodesVisited += 2;
+        compare(Entry{from_.getRootNode().get(), {}}, Entry{to_.getRootNode().get(), {}});
+    }
+
+   private:
+    void compare(const Entry& a, const Entry& b) {
+        if (a.node == nullptr && b.node == nullptr) {
+            return;
+        }
+        if (a.node == nullptr) {
+            emitAll(to_, b, LeafDiff::added);
+            return;
+        }
+        if (b.node == nullptr) {
+            emitAll(from_, a, LeafDiff::removed);
+            return;
+        }
+        auto [result, matchBytes] = ExtensionView{a.path}.compareTo(ByteSequenceToView(b.path));
+        switch (result) {
+            case ExtensionView::CompareResultType::equals:
+                if (a.isBranch() && b.isBranch()) {
+                    if (!compareHashes(a.node->hash(), b.node->hash())) {
+                        compareChildren(a, b);
+                    }
+                } else if (a.isBranch()) {
+                    expandFrom(a, b);
+                } else if (b.isBranch()) {
+                    expandTo(a, b);
+                } else if (!compareHashes(a.node->hash(), b.node->hash())) {
+                    out_.leaves.push_back(LeafDiff{LeafDiff::changed, a.path});
+                }
+                return;
+            case ExtensionView::CompareResultType::substring:
+                // a's path is a prefix of b's path, b lies within one of a's slots
+                if (a.isBranch()) {
+                    expandFrom(a, b);
+                    return;
+                }
+                // a is a leaf whose key is smaller than every key under b
+                emitAll(from_, a, LeafDiff::removed);
+                emitAll(to_, b, LeafDiff::added);
+                return;
+            case ExtensionView::CompareResultType::contains_other_extension:
+                if (b.isBranch()) {
+                    expandTo(a, b);
+                    return;
+                }
+                emitAll(to_, b, LeafDiff::added);
+                emitAll(from_, a, LeafDiff::removed);
+                return;
+            case ExtensionView::CompareResultType::diverge:
+                // disjoint key ranges
+                if (a.path[matchBytes] < b.path[matchBytes]) {
+                    emitAll(from_, a, LeafDiff::removed);
+                    emitAll(to_, b, LeafDiff::added);
+                } else {
+                    emitAll(to_, b, LeafDiff::added);
+                    emitAll(from_, a, LeafDiff::removed);
+                }
+                return;
+        }
+    }
+
+    // Both are branch nodes with the same path.
+    void compareChildren(const Entry& a, const Entry& b) {
+        compare(childEntry(from_, a, BranchNode::LeafChildPos),
+                childEntry(to_, b, BranchNode::LeafChildPos));
+        const auto* aNode = static_cast<const BranchNode*>(a.node);
+        const auto* bNode = static_cast<const BranchNode*>(b.node);
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            // prune on the HashOfBranch hashes so equal subtrees are not even loaded
+            const auto& aChild = aNode->getChildAt(byte);
+            const auto& bChild = bNode->getChildAt(byte);
+            if (aChild != nullptr && bChild != nullptr &&
+                aChild->getType() == Node::Type::HashOfBranch &&
+                bChild->getType() == Node::Type::HashOfBranch &&
+                compareHashes(aChild->hash(), bChild->hash())) {
+                continue;
+            }
+            compare(childEntry(from_, a, byte), childEntry(to_, b, byte));
+        }
+    }
+
+    // a is a branch node and b's path starts with a's path.
+    void expandFrom(const Entry& a, const Entry& b) {
+        auto slot = slotOf(a, b);
+        compare(childEntry(from_, a, BranchNode::LeafChildPos),
+                slot == BranchNode::LeafChildPos ? b : Entry{});
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            compare(childEntry(from_, a, byte), slot == byte ? b : Entry{});
+        }
+    }
+
+    // b is a branch node and a's path starts with b's path.
+    void expandTo(const Entry& a, const Entry& b) {
+        auto slot = slotOf(b, a);
+        compare(slot == BranchNode::LeafChildPos ? a : Entry{},
+                childEntry(to_, b, BranchNode::LeafChildPos));
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            compare(slot == byte ? a : Entry{}, childEntry(to_, b, byte));
+        }
+    }
+
+    static BranchNode::ChildPos slotOf(const Entry& branch, const Entry& other) {
+        if (other.path.size() == branch.path.size()) {
+            return BranchNode::LeafChildPos;
+        }
+        return other.path[branch.path.size()];
+    }
+
+    Entry childEntry(const Tree& tree, const Entry& branch, BranchNode::ChildPos pos) {
+        const auto& child = static_cast<const BranchNode*>(branch.node)->getChildAt(pos);
+        if (child == nullptr) {
+            return Entry{};
+        }
+        Entry entry{child.get(), branch.path};
+        if (pos == BranchNode::LeafChildPos) {
+            return entry;
+        }
+        entry.path.push_back(*pos);
+        if (child->getType() == Node::Type::HashOfBranch) {
+            entry.node = tree.getBranchNode(entry.path).get();
+            assert(entry.node != nullptr);
+            ++out_.nodesVisited;
+        }
+        auto ext = entry.node->extension();
+        entry.path.insert(entry.path.end(), ext.begin(), ext.end());
+        return entry;
+    }
+
+    void emitAll(const Tree& tree, const Entry& entry, LeafDiff::Kind kind) {
+        if (!entry.isBranch()) {
+            out_.leaves.push_back(LeafDiff{kind, entry.path});
+            return;
+        }
+        auto prefix = entry.path;
+        tree.forEachLeaf(*static_cast<const BranchNode*>(entry.node), prefix,
+                         [&](ByteSequenceView key, const Node&) {
+                             out_.leaves.push_back(LeafDiff{kind, ByteSequence{key.begin(), key.end()}});
+                         });
+    }
+
+    const Tree& from_;
+    const Tree& to_;
+    TreeDiff& out_;
+};
+
+}  // namespace
+
+TreeDiff diff(const Tree& from, const Tree& to) {
+    TreeDiff out;
+    Differ{from, to, out}.run();
+    return out;
+}
+
+};  // namespace merkle
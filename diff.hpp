@@ -0,0 +1,27 @@
+#include <vector>
+
+#include "tree.hpp"
+
+#pragma once
+
+namespace merkle {
+
+struct LeafDiff {
+    enum Kind : uint8_t { added, removed, changed };
+    Kind kind;
+    ByteSequence key;
+};
+
+struct TreeDiff {
+    // ordered by key
+    std::vector<LeafDiff> leaves;
+    // branch nodes compared between the trees, subtrees with equal hashes are never descended
+    size_t nodesVisited = 0;
+};
+
+// Walks both trees in lockstep and reports the leaves that were added, removed or changed going
+// from `from` to `to`. Both trees must be committed with calculateHash, a subtree whose hash matches
+// on both sides is skipped without being read.
+TreeDiff diff(const Tree& from, const Tree& to);
+
+};  // namespace merkle
@@ -0,0 +1,207 @@
+#include "node_log.hpp"
+
+#include <stack>
+
+#include "detail/file_io.hpp"
+
+namespace merkle {
+
+namespace {
+
+void appendSize(ByteSequence& out, uint64_t size) {
+    auto* pSize = reinterpret_cast<Byte*>(&size);
+    out.insert(out.end(), pSize, pSize + Node::kSizeField);
+}
+
+uint64_t readSize(const Byte* in) {
+    uint64_t size;
+    std::memcpy(&size, in, Node::kSizeField);
+    return size;
+}
+
+}  // namespace
+
+NodeLog::NodeLog(std::string path, Durability durability)
+    : path_(std::move(path)), durability_(durability) {
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throwErrno("NodeLog open " + path_);
+    }
+    try {
+        scan();
+        // the file may have just been created, its directory entry has to be on disk as well
+        if (durability_ == Durability::synced) {
+            syncParentDirectory(path_);
+        }
+    } catch (...) {
+        ::close(fd_);
+        throw;
+    }
+}
+
+NodeLog::~NodeLog() { ::close(fd_); }
+
+void NodeLog::scan() {
+    auto end = ::lseek(fd_, 0, SEEK_END);
+    if (end < 0) {
+        throwErrno("NodeLog seek");
+    }
+    auto size = static_cast<uint64_t>(end);
+    uint64_t offset = 0;
+    Byte header[kRecordHeaderSize];
+    ByteSequence key;
+    Byte nodePrefix[1 + SHA256_DIGEST_LENGTH];
+    while (size - offset >= kRecordHeaderSize) {
+        readAll(fd_, header, kRecordHeaderSize, offset);
+        auto version = readSize(header);
+        Location location;
+        location.offset = offset;
+        location.keySize = readSize(header + Node::kSizeField);
+        location.nodeSize = readSize(header + 2 * Node::kSizeField);
+        // the sizes are bounded one by one by what is left, summing garbage ones could wrap
+        auto left = size - offset - kRecordHeaderSize;
+        if (location.keySize > left || location.nodeSize > left - location.keySize ||
+            location.nodeSize < sizeof(nodePrefix)) {
+            break;
+        }
+        key.resize(location.keySize);
+        readAll(fd_, key.data(), key.size(), offset + kRecordHeaderSize);
+        readAll(fd_, nodePrefix, sizeof(nodePrefix), location.nodeOffset());
+        std::memcpy(location.hash, nodePrefix + 1, SHA256_DIGEST_LENGTH);
+        index_[key][version] = location;
+        // every version has a root record, which pruning removes along with the version
+        if (key.empty()) {
+            versions_.insert(version);
+        }
+        liveBytes_ += location.recordSize();
+        offset += location.recordSize();
+    }
+    if (offset != size && ::ftruncate(fd_, static_cast<off_t>(offset)) != 0) {
+        throwErrno("NodeLog truncate");
+    }
+    fileBytes_ = offset;
+}
+
+size_t NodeLog::commit(const Tree& tree, uint64_t version) {
+    std::shared_lock fileLock(fileMutex_);
+    std::lock_guard lock(mutex_);
+    assert(versions_.empty() || version > *versions_.rbegin());
+    ByteSequence records;
+    std::vector<std::pair<ByteSequence, Location>> appended;
+    std::stack<std::pair<ByteSequence, const BranchNode*>> pending;
+    pending.emplace(ByteSequence{}, tree.getRootNode().get());
+    while (!pending.empty()) {
+        auto [dbKey, node] = std::move(pending.top());
+        pending.pop();
+        // the root is always written so that every version has a record
+        auto itr = index_.find(dbKey);
+        if (!dbKey.empty() && itr != index_.end() && !itr->second.empty() &&
+            compareHashes(itr->second.rbegin()->second.hash, node->hash())) {
+            continue;
+        }
+        Location location;
+        location.generation = generation_;
+        location.offset = fileBytes_ + records.size();
+        location.keySize = dbKey.size();
+        std::memcpy(location.hash, node->hash(), SHA256_DIGEST_LENGTH);
+        ByteSequence nodeBytes;
+        node->serialize(nodeBytes);
+        location.nodeSize = nodeBytes.size();
+        appendSize(records, version);
+        appendSize(records, location.keySize);
+        appendSize(records, location.nodeSize);
+        records.insert(records.end(), dbKey.begin(), dbKey.end());
+        records.insert(records.end(), nodeBytes.begin(), nodeBytes.end());
+
+        auto prefix = dbKey;
+        prefix.insert(prefix.end(), node->extension().begin(), node->extension().end());
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            if (node->getTypeOfChild(byte) != Node::Type::HashOfBranch) {
+                continue;
+            }
+            auto childKey = prefix;
+            childKey.push_back(byte);
+            const auto& child = tree.getBranchNode(childKey);
+            assert(child != nullptr);
+            pending.emplace(std::move(childKey), child.get());
+        }
+        appended.emplace_back(std::move(dbKey), location);
+    }
+    writeAll(fd_, records.data(), records.size(), fileBytes_);
+    if (durability_ == Durability::synced && ::fdatasync(fd_) != 0) {
+        throwErrno("NodeLog sync " + path_);
+    }
+    fileBytes_ += records.size();
+    liveBytes_ += records.size();
+    for (auto& [dbKey, location] : appended) {
+        index_[std::move(dbKey)][version] = location;
+    }
+    versions_.insert(version);
+    return appended.size();
+}
+
+std::optional<NodeLog::Location> NodeLog::locate(ByteSequenceView dbKey, uint64_t version) const {
+    std::lock_guard lock(mutex_);
+    auto itr = index_.find(dbKey);
+    if (itr == index_.end()) {
+        return std::nullopt;
+    }
+    // the newest record not newer than version
+    auto versionItr = itr->second.upper_bound(version);
+    if (versionItr == itr->second.begin()) {
+        return std::nullopt;
+    }
+    return std::prev(versionItr)->second;
+}
+
+std::optional<ByteSequence> NodeLog::readNode(const Location& location) const {
+    std::shared_lock fileLock(fileMutex_);
+    if (location.generation != generation_) {
+        return std::nullopt;
+    }
+    ByteSequence bytes(location.nodeSize);
+    readAll(fd_, bytes.data(), bytes.size(), location.nodeOffset());
+    return bytes;
+}
+
+std::optional<ByteSequence> NodeLog::loadBytes(ByteSequenceView dbKey, uint64_t version) const {
+    while (true) {
+        auto location = locate(dbKey, version);
+        if (!location) {
+            return std::nullopt;
+        }
+        // a compaction may have moved the record in between, look it up again
+        auto bytes = readNode(*location);
+        if (bytes) {
+            return bytes;
+        }
+    }
+}
+
+std::unique_ptr<BranchNode> NodeLog::load(ByteSequenceView dbKey, uint64_t version) const {
+    auto bytes = loadBytes(dbKey, version);
+    return bytes ? BranchNode::deserializeCommitted(*bytes) : nullptr;
+}
+
+std::vector<uint64_t> NodeLog::versions() const {
+    std::lock_guard lock(mutex_);
+    return {versions_.begin(), versions_.end()};
+}
+
+uint64_t NodeLog::fileBytes() const {
+    std::lock_guard lock(mutex_);
+    return fileBytes_;
+}
+
+uint64_t NodeLog::generation() const {
+    std::shared_lock fileLock(fileMutex_);
+    return generation_;
+}
+
+uint64_t NodeLog::liveBytes() const {
+    std::lock_guard lock(mutex_);
+    return liveBytes_;
+}
+
+};  // namespace merkle
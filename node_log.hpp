@@ -0,0 +1,100 @@
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+
+#include "tree.hpp"
+
+#pragma once
+
+namespace merkle {
+
+struct CompactionResult;
+
+// Append-only file of versioned branch nodes. Each commit appends the branch nodes that changed
+// since the previous commit, tagged with the commit's version, so version v of the tree is made
+// of the newest record of every db key that is not newer than v. The root goes under the empty db
+// key like in proofs.
+//
+// Record: version, db key size and node size as native 8 byte integers, then the db key and the
+// serialized node. The index of all records is kept in memory and rebuilt by scanning the file on
+// open, a torn record at the end of the file is cut off. Pruned records come back on open until the
+// log is compacted, see compactor.hpp.
+//
+// All members are thread safe. I/O errors throw std::system_error.
+class NodeLog {
+   public:
+    // synced: commit returns once its records are on disk. buffered: commit returns once they are
+    // written, a crash can lose the last versions even though older ones were pruned already.
+    enum class Durability : uint8_t { synced, buffered };
+
+    static constexpr uint64_t kRecordHeaderSize = 3 * Node::kSizeField;
+
+    struct Location {
+        uint64_t offset = 0;
+        uint64_t keySize = 0;
+        uint64_t nodeSize = 0;
+        // the hash of the node, as found in its serialized bytes
+        unsigned char hash[SHA256_DIGEST_LENGTH] = {};
+        // compaction moves the records, locations of an older generation are stale
+        uint64_t generation = 0;
+
+        uint64_t nodeOffset() const { return offset + kRecordHeaderSize + keySize; }
+        uint64_t recordSize() const { return kRecordHeaderSize + keySize + nodeSize; }
+    };
+    // the records of one db key by version
+    using Versions = std::map<uint64_t, Location>;
+    using Index = std::map<ByteSequence, Versions, LessThan>;
+
+    explicit NodeLog(std::string path, Durability durability = Durability::synced);
+    ~NodeLog();
+    NodeLog(const NodeLog&) = delete;
+    NodeLog& operator=(const NodeLog&) = delete;
+
+    // Appends the root and the nodes of tree whose hash differs from their newest record, subtrees
+    // whose top node is unchanged are not descended. The tree must be committed with calculateHash
+    // and versions must increase. Returns the number of nodes appended.
+    size_t commit(const Tree& tree, uint64_t version);
+
+    // The record of dbKey as of version, nullopt when there is none or it was pruned.
+    std::optional<Location> locate(ByteSequenceView dbKey, uint64_t version) const;
+    // nullopt when the log was compacted since location was found
+    std::optional<ByteSequence> readNode(const Location& location) const;
+    // the serialized node of dbKey as of version, nullopt when there is none
+    std::optional<ByteSequence> loadBytes(ByteSequenceView dbKey, uint64_t version) const;
+    // the same deserialized, null as well when the record is not well formed
+    std::unique_ptr<BranchNode> load(ByteSequenceView dbKey, uint64_t version) const;
+
+    // committed versions that were not pruned, oldest first
+    std::vector<uint64_t> versions() const;
+    const std::string& path() const { return path_; }
+    uint64_t fileBytes() const;
+    // bytes of the records in the index, the rest of the file is garbage left for compaction
+    uint64_t liveBytes() const;
+    uint64_t deadBytes() const { return fileBytes() - liveBytes(); }
+    // bumped by every compaction
+    uint64_t generation() const;
+
+   private:
+    friend class Pruner;
+    friend CompactionResult compact(NodeLog& log, uint64_t writeBytesPerSecond);
+
+    void scan();
+
+    std::string path_;
+    Durability durability_;
+    int fd_ = -1;
+    // held shared while reading the file and exclusively while compaction swaps it, taken before
+    // mutex_
+    mutable std::shared_mutex fileMutex_;
+    // guards the index and the counters
+    mutable std::mutex mutex_;
+    Index index_;
+    std::set<uint64_t> versions_;
+    uint64_t fileBytes_ = 0;
+    uint64_t liveBytes_ = 0;
+    uint64_t generation_ = 0;
+};
+
+};  // namespace merkle
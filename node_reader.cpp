@@ -0,0 +1,99 @@
+#include "node_reader.hpp"
+
+namespace merkle {
+
+std::future<std::optional<ByteSequence>> AsyncNodeReader::read(ByteSequence dbKey,
+                                                               uint64_t version) {
+    return pool_.submit([this, dbKey = std::move(dbKey), version] {
+        return log_.loadBytes(dbKey, version);
+    });
+}
+
+std::vector<std::optional<ByteSequence>> AsyncNodeReader::readBatch(
+    std::span<const ByteSequence> dbKeys, uint64_t version) {
+    std::vector<std::future<std::optional<ByteSequence>>> pending;
+    pending.reserve(dbKeys.size());
+    for (const auto& dbKey : dbKeys) {
+        pending.push_back(read(dbKey, version));
+    }
+    std::vector<std::optional<ByteSequence>> nodes;
+    nodes.reserve(dbKeys.size());
+    for (auto& future : pending) {
+        nodes.push_back(future.get());
+    }
+    return nodes;
+}
+
+Proof generateMultiProof(AsyncNodeReader& reader, uint64_t version,
+                         std::span<const ByteSequence> keys, LogProofStats* stats) {
+    Proof proof;
+    LogProofStats localStats;
+    // The keys still descending, each at the db key of the node it needs next. The views point
+    // into keys, so the db key of a node is the part of the key consumed so far like in walkPath.
+    std::vector<ExtensionView> descending;
+    descending.reserve(keys.size());
+    for (const auto& key : keys) {
+        descending.emplace_back(key);
+    }
+    // nodes read, deserialized for the descent, by db key
+    std::map<ByteSequence, std::unique_ptr<BranchNode>, LessThan> nodes;
+    std::vector<ByteSequence> toRead;
+    while (!descending.empty()) {
+        toRead.clear();
+        for (const auto& extension : descending) {
+            auto dbKey = extension.getKeySoFar();
+            if (nodes.find(dbKey) == nodes.end()) {
+                toRead.emplace_back(dbKey.begin(), dbKey.end());
+            }
+        }
+        // the upper nodes are needed by many keys, read each once
+        std::sort(toRead.begin(), toRead.end(), LessThan{});
+        toRead.erase(std::unique(toRead.begin(), toRead.end()), toRead.end());
+        auto read = reader.readBatch(toRead, version);
+        ++localStats.rounds;
+        localStats.nodesRead += toRead.size();
+        for (size_t i = 0; i < toRead.size(); ++i) {
+            // a child the parent points to is missing only when the version is gone
+            if (!read[i]) {
+                continue;
+            }
+            // a torn or corrupt record fails the whole proof rather than the descent
+            auto node = BranchNode::deserializeCommitted(*read[i]);
+            if (node == nullptr) {
+                if (stats != nullptr) {
+                    *stats = localStats;
+                }
+                return Proof{};
+            }
+            nodes.emplace(toRead[i], std::move(node));
+            proof.nodes.emplace(std::move(toRead[i]), std::move(*read[i]));
+        }
+
+        size_t kept = 0;
+        for (auto& extension : descending) {
+            auto itr = nodes.find(extension.getKeySoFar());
+            if (itr == nodes.end()) {
+                continue;
+            }
+            const auto& branchNode = *itr->second;
+            auto [result, matchBytes] = extension.compareTo(branchNode.extension());
+            if (result != ExtensionView::CompareResultType::contains_other_extension) {
+                continue;
+            }
+            extension.incrementPositionBy(matchBytes);
+            auto currentByte = *extension.getCurrentByte();
+            extension.incrementPositionBy(1);
+            const auto& child = branchNode.getChildAt(currentByte);
+            if (child != nullptr && child->getType() == Node::Type::HashOfBranch) {
+                descending[kept++] = extension;
+            }
+        }
+        descending.erase(descending.begin() + kept, descending.end());
+    }
+    if (stats != nullptr) {
+        *stats = localStats;
+    }
+    return proof;
+}
+
+};  // namespace merkle
@@ -0,0 +1,50 @@
+#include <future>
+#include <span>
+
+#include "detail/thread_pool.hpp"
+#include "node_log.hpp"
+#include "proof.hpp"
+
+#pragma once
+
+namespace merkle {
+
+// Reads nodes of a NodeLog on a pool of threads, so that many reads are in flight at once instead
+// of one blocking read per tree level. The threads mostly wait on the disk, so there are more of
+// them than cores.
+class AsyncNodeReader {
+   public:
+    static constexpr size_t kDefaultThreads = 16;
+
+    explicit AsyncNodeReader(const NodeLog& log, size_t numThreads = kDefaultThreads)
+        : log_(log), pool_(numThreads) {}
+
+    // The serialized node of dbKey as of version, nullopt when there is none.
+    std::future<std::optional<ByteSequence>> read(ByteSequence dbKey, uint64_t version);
+    // Issues all the reads before waiting on any, results are in dbKeys order.
+    std::vector<std::optional<ByteSequence>> readBatch(std::span<const ByteSequence> dbKeys,
+                                                       uint64_t version);
+
+    const NodeLog& log() const { return log_; }
+    size_t numThreads() const { return pool_.size(); }
+
+   private:
+    const NodeLog& log_;
+    ThreadPool pool_;
+};
+
+struct LogProofStats {
+    // read rounds, one per level of the deepest path, and nodes read
+    size_t rounds = 0;
+    size_t nodesRead = 0;
+};
+
+// The multi-proof of keys in version of the log, the same proof generateMultiProof gives for the
+// tree that was committed as version. The paths are walked level by level: every round reads the
+// distinct nodes that the keys still descending need next as one batch, then moves each key one
+// level down. Empty when the version is gone or a node read back from the log is not well formed,
+// e.g. a torn or corrupt record.
+Proof generateMultiProof(AsyncNodeReader& reader, uint64_t version,
+                         std::span<const ByteSequence> keys, LogProofStats* stats = nullptr);
+
+};  // namespace merkle
@@ -3,15 +3,21 @@
 #include <cstring>
 namespace merkle {
 
-void HashOfLeaf::updateHash(const ByteSequence& key, const ByteSequence& value) {
+void HashOfLeaf::updateHash(ByteSequenceView key, ByteSequenceView value) {
+    computeHash(key, value, getMutableHash());
+    pending_.reset();
+    valueFingerprint_ = kNoFingerprint;
+}
+
+void HashOfLeaf::computeHash(ByteSequenceView key, ByteSequenceView value, unsigned char* out) {
     size_t size = key.size();
     auto* size_p = reinterpret_cast<char*>(&size);
     ByteSequence to_hash;
     to_hash.reserve(sizeof(size) + key.size() + value.size());
     std::copy(size_p, size_p + sizeof(size), std::back_insert_iterator(to_hash));
-    std::copy(key.cbegin(), key.cend(), std::back_insert_iterator(to_hash));
-    std::copy(value.cbegin(), value.cend(), std::back_insert_iterator(to_hash));
-    computeSHA256<ByteSequence>(to_hash, getMutableHash());
+    std::copy(key.begin(), key.end(), std::back_insert_iterator(to_hash));
+    std::copy(value.begin(), value.end(), std::back_insert_iterator(to_hash));
+    computeSHA256<ByteSequence>(to_hash, out);
 }
 
 HashOfLeaf::HashOfLeaf(const ByteSequence& key, const ByteSequence& value) {
@@ -21,21 +27,72 @@ HashOfLeaf::HashOfLeaf(const ByteSequence& key, const ByteSequence& value) {
 const ByteSequence BranchNode::kNullNodeToHash = {0};
 unsigned char BranchNode::kNullNodeHash[SHA256_DIGEST_LENGTH] = {};
 
-void BranchNode::computeHash() {
-    ByteSequence to_hash;
-    if (leaf_ == nullptr) {
-        to_hash.insert(to_hash.end(), kNullNodeHash, kNullNodeHash + SHA256_DIGEST_LENGTH);
-    } else {
-        to_hash.insert(to_hash.end(), leaf_->hash(), leaf_->hash() + SHA256_DIGEST_LENGTH);
+namespace {
+
+// the ChildrenTree the static computeHash builds, one per thread and mode
+ChildrenTree& scratchChildrenTree(BranchHashing hashing) {
+    thread_local ChildrenTree binary(BranchHashing::binary);
+    thread_local ChildrenTree radix16(BranchHashing::radix16);
+    auto& tree = hashing == BranchHashing::binary ? binary : radix16;
+    tree.clear();
+    return tree;
+}
+
+}  // namespace
+
+BranchNode::~BranchNode() = default;
+
+BranchNode::ChildHashes BranchNode::childHashes() const {
+    ChildHashes childHashes;
+    for (size_t i = 0; i < kBranchingFactor; ++i) {
+        childHashes[i] = children_[i] == nullptr ? nullptr : children_[i]->hash();
     }
-    for (const auto& child : children_) {
-        if (child == nullptr) {
-            to_hash.insert(to_hash.end(), kNullNodeHash, kNullNodeHash + SHA256_DIGEST_LENGTH);
-        } else {
-            to_hash.insert(to_hash.end(), child->hash(), child->hash() + SHA256_DIGEST_LENGTH);
-        }
+    return childHashes;
+}
+
+void BranchNode::computeHash(BranchHashing hashing) {
+    auto hashes = childHashes();
+    const auto* leafHash = leaf_ == nullptr ? nullptr : leaf_->hash();
+    auto numChildren = static_cast<size_t>(std::count_if(
+        hashes.begin(), hashes.end(), [](const auto* hash) { return hash != nullptr; }));
+    if (hashing == BranchHashing::flat || numChildren < kCachedChildrenTreeFrom) {
+        childrenTree_.reset();
+        computeHash(leafHash, hashes, getMutableHash(), hashing);
+        return;
+    }
+    if (childrenTree_ == nullptr || childrenTree_->hashing() != hashing) {
+        childrenTree_ = std::make_unique<ChildrenTree>(hashing);
     }
-    computeSHA256<ByteSequence>(to_hash, getMutableHash());
+    computeHash(leafHash, childrenTree_->update(hashes), getMutableHash());
+}
+
+void BranchNode::computeHash(const unsigned char* leafHash, const ChildHashes& childHashes,
+                             unsigned char* out, BranchHashing hashing) {
+    if (hashing != BranchHashing::flat) {
+        computeHash(leafHash, scratchChildrenTree(hashing).update(childHashes), out);
+        return;
+    }
+    ByteSequence to_hash;
+    to_hash.reserve((1 + kBranchingFactor) * SHA256_DIGEST_LENGTH);
+    auto append = [&to_hash](const unsigned char* hash) {
+        hash = hash == nullptr ? kNullNodeHash : hash;
+        to_hash.insert(to_hash.end(), hash, hash + SHA256_DIGEST_LENGTH);
+    };
+    append(leafHash);
+    for (const auto* childHash : childHashes) {
+        append(childHash);
+    }
+    computeSHA256<ByteSequence>(to_hash, out);
+}
+
+void BranchNode::computeHash(const unsigned char* leafHash, const unsigned char* childrenRoot,
+                             unsigned char* out) {
+    SHA256_CTX sha;
+    SHA256_Init(&sha);
+    SHA256_Update(&sha, leafHash == nullptr ? kNullNodeHash : leafHash, SHA256_DIGEST_LENGTH);
+    SHA256_Update(&sha, childrenRoot == nullptr ? kNullNodeHash : childrenRoot,
+                  SHA256_DIGEST_LENGTH);
+    SHA256_Final(out, &sha);
 }
 
 void BranchNode::updateHashOfLeafChild(Byte child, const ByteSequence& key,
@@ -46,6 +103,140 @@ void BranchNode::updateHashOfLeafChild(Byte child, const ByteSequence& key,
     hashOfLeaf->updateHash(key, value);
 }
 
+size_t BranchNode::resolvePendingLeaves() {
+    size_t resolved = 0;
+    auto resolve = [&resolved](std::unique_ptr<Node>& node) {
+        if (node == nullptr || node->getType() != Node::Type::HashOfLeaf) {
+            return;
+        }
+        auto* hashOfLeaf = static_cast<merkle::HashOfLeaf*>(node.get());
+        if (hashOfLeaf->isPending()) {
+            hashOfLeaf->resolveHash();
+            ++resolved;
+        }
+    };
+    resolve(leaf_);
+    for (auto& child : children_) {
+        resolve(child);
+    }
+    return resolved;
+}
+
+ChildrenTree::ChildrenTree(BranchHashing hashing)
+    : hashing_(hashing), arity_(arity(hashing)) {
+    assert(hashing != BranchHashing::flat);
+    size_t numEntries = 0;
+    for (size_t width = BranchNode::kBranchingFactor; width >= 1; width /= arity_) {
+        numEntries += width;
+    }
+    hashes_.resize(numEntries);
+    present_.assign(numEntries, 0);
+}
+
+const unsigned char* ChildrenTree::hashBlock(std::span<const unsigned char* const> entries,
+                                             unsigned char* out) {
+    auto isEmpty = [](const unsigned char* hash) { return hash == nullptr; };
+    if (std::all_of(entries.begin(), entries.end(), isEmpty)) {
+        return nullptr;
+    }
+    SHA256_CTX sha;
+    SHA256_Init(&sha);
+    for (const auto* hash : entries) {
+        SHA256_Update(&sha, hash == nullptr ? BranchNode::kNullNodeHash : hash,
+                      SHA256_DIGEST_LENGTH);
+    }
+    SHA256_Final(out, &sha);
+    return out;
+}
+
+const unsigned char* ChildrenTree::update(const BranchNode::ChildHashes& childHashes) {
+    // changed[i] tells whether entry i of the current level changed
+    std::array<bool, BranchNode::kBranchingFactor> changed{};
+    bool anyChanged = false;
+    for (size_t i = 0; i < BranchNode::kBranchingFactor; ++i) {
+        const auto* hash = childHashes[i];
+        const auto* old = entry(i);
+        if (hash == nullptr ? old == nullptr : old != nullptr && compareHashes(hash, old)) {
+            continue;
+        }
+        present_[i] = hash != nullptr;
+        if (hash != nullptr) {
+            std::memcpy(hashes_[i].data(), hash, SHA256_DIGEST_LENGTH);
+        }
+        changed[i] = true;
+        anyChanged = true;
+    }
+    std::array<const unsigned char*, 16> block;
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    size_t offset = 0;
+    for (size_t width = BranchNode::kBranchingFactor; width > 1 && anyChanged; width /= arity_) {
+        auto above = offset + width;
+        anyChanged = false;
+        for (size_t i = 0; i < width / arity_; ++i) {
+            auto first = i * arity_;
+            bool blockChanged = std::any_of(changed.begin() + first,
+                                            changed.begin() + first + arity_,
+                                            [](bool c) { return c; });
+            changed[i] = false;
+            if (!blockChanged) {
+                continue;
+            }
+            for (size_t j = 0; j < arity_; ++j) {
+                block[j] = entry(offset + first + j);
+            }
+            const auto* blockHash = hashBlock(std::span{block.data(), arity_}, hash);
+            const auto* old = entry(above + i);
+            if (blockHash == nullptr ? old == nullptr
+                                     : old != nullptr && compareHashes(blockHash, old)) {
+                continue;
+            }
+            present_[above + i] = blockHash != nullptr;
+            if (blockHash != nullptr) {
+                std::memcpy(hashes_[above + i].data(), blockHash, SHA256_DIGEST_LENGTH);
+            }
+            changed[i] = true;
+            anyChanged = true;
+        }
+        offset = above;
+    }
+    return root();
+}
+
+void ChildrenTree::siblings(Byte child, std::vector<const unsigned char*>& out) const {
+    size_t index = child;
+    size_t offset = 0;
+    for (size_t width = BranchNode::kBranchingFactor; width > 1; width /= arity_) {
+        auto first = index - index % arity_;
+        for (size_t j = first; j < first + arity_; ++j) {
+            if (j != index) {
+                out.push_back(entry(offset + j));
+            }
+        }
+        offset += width;
+        index /= arity_;
+    }
+}
+
+const unsigned char* ChildrenTree::foldPath(BranchHashing hashing, Byte child,
+                                            const unsigned char* childHash,
+                                            std::span<const unsigned char* const> siblings,
+                                            unsigned char* out) {
+    auto blockSize = arity(hashing);
+    assert(siblings.size() == numSiblings(hashing));
+    std::array<const unsigned char*, 16> block;
+    const auto* hash = childHash;
+    size_t index = child;
+    auto sibling = siblings.begin();
+    for (size_t width = BranchNode::kBranchingFactor; width > 1; width /= blockSize) {
+        for (size_t j = 0; j < blockSize; ++j) {
+            block[j] = j == index % blockSize ? hash : *sibling++;
+        }
+        hash = hashBlock(std::span{block.data(), blockSize}, out);
+        index /= blockSize;
+    }
+    return hash;
+}
+
 void Node::serialize(ByteSequence& out) const {
     out.insert(out.end(), hash_, hash_ + SHA256_DIGEST_LENGTH);
     uint64_t extSize = extension_.size();
@@ -93,6 +284,63 @@ std::unique_ptr<BranchNode> BranchNode::deserialize(const ByteSequence& in) {
     return bn;
 }
 
+namespace {
+
+// Whether in is exactly one serialized branch node of a committed tree. Walks the layout that
+// BranchNode::deserialize reads with bounds checks.
+bool isCommittedBranchNode(ByteSequenceView in) {
+    size_t pos = 0;
+    // type, hash, extension size and extension
+    auto skipNode = [&in, &pos](Node::Type type) {
+        if (in.size() - pos < 1 + SHA256_DIGEST_LENGTH + Node::kSizeField || in[pos] != type) {
+            return false;
+        }
+        pos += 1 + SHA256_DIGEST_LENGTH;
+        uint64_t extSize;
+        std::memcpy(&extSize, in.data() + pos, Node::kSizeField);
+        pos += Node::kSizeField;
+        if (in.size() - pos < extSize) {
+            return false;
+        }
+        pos += extSize;
+        return true;
+    };
+    if (!skipNode(Node::BranchNode)) {
+        return false;
+    }
+    // the leaf slot, then the children
+    for (size_t slot = 0; slot <= BranchNode::kBranchingFactor; ++slot) {
+        if (pos == in.size()) {
+            return false;
+        }
+        auto type = in[pos];
+        if (type == Node::NullNode) {
+            ++pos;
+        } else if (type == Node::HashOfLeaf) {
+            if (!skipNode(Node::HashOfLeaf)) {
+                return false;
+            }
+        } else if (slot == 0 || !skipNode(Node::HashOfBranch) || pos == in.size() ||
+                   in[pos++] != 0) {
+            // a branch in the leaf slot, an unknown type or a dirty HashOfBranch
+            return false;
+        }
+    }
+    return pos == in.size();
+}
+
+}  // namespace
+
+std::unique_ptr<BranchNode> BranchNode::deserializeCommitted(ByteSequenceView in) {
+    if (!isCommittedBranchNode(in)) {
+        return nullptr;
+    }
+    auto bn = std::make_unique<BranchNode>();
+    size_t pos = 0;
+    bn->deserialize(in, pos);
+    return bn;
+}
+
 void Node::deserialize(const ByteSequenceView& in, size_t& pos) {
     std::memcpy(hash_, in.data() + pos, SHA256_DIGEST_LENGTH);
     pos += SHA256_DIGEST_LENGTH;
@@ -5,6 +5,8 @@
 #include <limits>
 #include <memory>
 #include <optional>
+#include <span>
+#include <vector>
 
 #include "detail/crypto_utils.hpp"
 #include "detail/key_utils.hpp"
@@ -94,7 +96,44 @@ class HashOfLeaf : public Node {
         setExtension(std::move(extension));
     }
 
-    void updateHash(const ByteSequence& key, const ByteSequence& value);
+    void updateHash(ByteSequenceView key, ByteSequenceView value);
+    static void computeHash(ByteSequenceView key, ByteSequenceView value, unsigned char* out);
+    // Takes a hash computed by the caller, as computeHash would.
+    void setHash(const unsigned char* hash) {
+        std::memcpy(getMutableHash(), hash, SHA256_DIGEST_LENGTH);
+        pending_.reset();
+        valueFingerprint_ = kNoFingerprint;
+    }
+
+    // Deferred hashing: the leaf owns its full key and value and hash() is stale until
+    // resolveHash. Setting a new pending value drops the previous one without hashing it.
+    void setPending(ByteSequence&& key, ByteSequence&& value) {
+        pending_ = std::make_unique<Pending>(std::move(key), std::move(value));
+        valueFingerprint_ = kNoFingerprint;
+    }
+    bool isPending() const { return pending_ != nullptr; }
+    // the value waiting to be hashed, null when not pending
+    const ByteSequence* pendingValue() const { return isPending() ? &pending_->value : nullptr; }
+    void resolveHash() {
+        assert(isPending());
+        // the value stays the same, and so does its caller's fingerprint
+        computeHash(pending_->key, pending_->value, getMutableHash());
+        pending_.reset();
+    }
+    // Copies the current hash into out, hashing the pending key and value when there are any.
+    void hashInto(unsigned char* out) const {
+        if (isPending()) {
+            computeHash(pending_->key, pending_->value, out);
+            return;
+        }
+        std::memcpy(out, hash(), SHA256_DIGEST_LENGTH);
+    }
+
+    // The fingerprint the caller gave with the value last written, see Tree::insert. Every write
+    // clears it, the tree sets it again after writing. Kept in memory only.
+    static constexpr uint64_t kNoFingerprint = 0;
+    uint64_t valueFingerprint() const { return valueFingerprint_; }
+    void setValueFingerprint(uint64_t fingerprint) { valueFingerprint_ = fingerprint; }
 
     Node::Type getType() const override { return Node::HashOfLeaf; }
     ~HashOfLeaf() override = default;
@@ -108,27 +147,76 @@ class HashOfLeaf : public Node {
         return std::make_unique<HashOfLeaf>(key, value, std::move(extension));
     }
 
+
     std::ostream& print(std::ostream& os) const override {
-        os << "HashOfLeaf: Hash: " << Node::toHex(hash()) << " extension " << extension();
+        os << "HashOfLeaf: Hash: " << Node::toHex(hash()) << " extension " << extension()
+           << " is pending " << isPending();
         return os;
     }
+
+   private:
+    struct Pending {
+        ByteSequence key;
+        ByteSequence value;
+    };
+    std::unique_ptr<Pending> pending_;
+    uint64_t valueFingerprint_ = kNoFingerprint;
 };
 
+// How a branch node commits to its children, part of the tree format as every hash depends on it.
+// flat hashes the leaf slot and the 256 child hashes in one go, a proof step then takes every
+// sibling. binary and radix16 first fold the children into a Merkle tree of arity 2 or 16, see
+// ChildrenTree, and hash the leaf slot with its root, kNullNodeHash standing in for either when
+// empty: a proof step takes 8 or 2 * 15 sibling hashes and a changed child rehashes one small block
+// per level of that tree.
+enum class BranchHashing : uint8_t { flat, binary, radix16 };
+
+class ChildrenTree;
+
 class BranchNode : public Node {
    public:
     using ChildPos = std::optional<Byte>;
     static constexpr ChildPos LeafChildPos = std::nullopt;
     using ChildAndPos = std::pair<std::reference_wrapper<std::unique_ptr<Node>>, ChildPos>;
-    static constexpr uint16_t kBranchingFactor = std::numeric_limits<uint8_t>::max();
+    static constexpr uint16_t kBranchingFactor = std::numeric_limits<uint8_t>::max() + 1;
     static const ByteSequence kNullNodeToHash;
     static unsigned char kNullNodeHash[SHA256_DIGEST_LENGTH];
     using ChildrenArray = std::array<std::unique_ptr<Node>, kBranchingFactor>;
+    using ChildHashes = std::array<const unsigned char*, kBranchingFactor>;
+    // Nodes with at least this many children keep their ChildrenTree between hashes, so that a
+    // commit only rehashes the blocks above the children that changed. Sparser nodes hash theirs
+    // from scratch, it is small.
+    static constexpr size_t kCachedChildrenTreeFrom = 32;
     Node::Type getType() const override { return Node::BranchNode; }
-    void computeHash();
+    void computeHash(BranchHashing hashing = BranchHashing::flat);
+    // The hash of a branch node from the hashes of its leaf slot and children, null for an empty
+    // slot. For hashing a node that only exists as its parts, e.g. the root of a sharded tree.
+    static void computeHash(const unsigned char* leafHash, const ChildHashes& childHashes,
+                            unsigned char* out, BranchHashing hashing = BranchHashing::flat);
+    // The hash of a binary or radix16 branch node from its leaf slot and the root of its
+    // ChildrenTree, null when empty.
+    static void computeHash(const unsigned char* leafHash, const unsigned char* childrenRoot,
+                            unsigned char* out);
+    // the hashes of the children, null for the empty ones
+    ChildHashes childHashes() const;
+    // The ChildrenTree kept since the last computeHash, null when the node has too few children
+    // or is flat.
+    const ChildrenTree* childrenTree() const { return childrenTree_.get(); }
 
     void setLeaf(const ByteSequence& key, const ByteSequence& value) {
         leaf_ = std::make_unique<merkle::HashOfLeaf>(key, value);
     }
+    // The leaf slot, created empty when missing.
+    merkle::HashOfLeaf& getMutableLeaf() {
+        if (leaf_ == nullptr) {
+            leaf_ = std::make_unique<merkle::HashOfLeaf>();
+        }
+        return static_cast<merkle::HashOfLeaf&>(*leaf_);
+    }
+    merkle::HashOfLeaf& getMutableLeafChild(Byte child) {
+        assert(getTypeOfChild(child) == Node::Type::HashOfLeaf);
+        return static_cast<merkle::HashOfLeaf&>(*children_[child]);
+    }
 
     Node::Type getTypeOfChild(ChildPos optChild) const {
         if (optChild == LeafChildPos) {
@@ -148,19 +236,27 @@ class BranchNode : public Node {
         return children_[*optChild];
     }
 
+    bool isDirty(ChildPos optChild) const {
+        return getTypeOfChild(optChild) == Node::Type::HashOfBranch &&
+               static_cast<const merkle::HashOfBranch*>(children_[*optChild].get())->isDirty();
+    }
+
     void setDirty(ChildPos optChild, bool dirty) {
-        auto type = getTypeOfChild(optChild);
-        assert(type == Node::Type::HashOfBranch);
+        assert(getTypeOfChild(optChild) == Node::Type::HashOfBranch);
         static_cast<merkle::HashOfBranch*>(children_[*optChild].get())->setDirty(dirty);
     }
 
     void updateHashOfBranchHash(ChildPos optChild, const unsigned char* hash) {
-        auto type = getTypeOfChild(optChild);
-        assert(type == Node::Type::HashOfBranch);
+        assert(getTypeOfChild(optChild) == Node::Type::HashOfBranch);
         auto* node = children_[*optChild].get();
         std::memcpy(node->getMutableHash(), hash, SHA256_DIGEST_LENGTH);
     }
 
+    void updateHashOfBranchExtension(ChildPos optChild, ByteSequenceView extension) {
+        assert(getTypeOfChild(optChild) == Node::Type::HashOfBranch);
+        children_[*optChild]->setExtension(ByteSequence{extension.begin(), extension.end()});
+    }
+
     void swapNodeAtChild(std::optional<Byte> optChild, std::unique_ptr<Node>& other) {
         if (optChild == LeafChildPos) {
             swapLeaf(other);
@@ -169,9 +265,12 @@ class BranchNode : public Node {
         children_[*optChild].swap(other);
     }
     void updateHashOfLeafChild(Byte child, const ByteSequence& key, const ByteSequence& value);
+    // Hashes the pending leaves among the children, returns how many were hashed. Must run before
+    // computeHash when the tree defers leaf hashing.
+    size_t resolvePendingLeaves();
 
     BranchNode() = default;
-    ~BranchNode() override = default;
+    ~BranchNode() override;
     BranchNode(const BranchNode&) = delete;
     BranchNode& operator=(const BranchNode&) = delete;
 
@@ -196,7 +295,11 @@ class BranchNode : public Node {
 
     static void setNullNodeHash() { computeSHA256<ByteSequence>(kNullNodeToHash, kNullNodeHash); }
 
+    // Trusts its input, for bytes the tree wrote itself.
     static std::unique_ptr<BranchNode> deserialize(const ByteSequence& in);
+    // For bytes from outside, e.g. proofs and snapshots: null unless in is exactly one serialized
+    // branch node of a committed tree, i.e. well formed and without a dirty HashOfBranch.
+    static std::unique_ptr<BranchNode> deserializeCommitted(ByteSequenceView in);
     void serialize(ByteSequence& out) const override;
     void deserialize(const ByteSequenceView& in, size_t& pos) override;
 
@@ -223,6 +326,57 @@ class BranchNode : public Node {
     void swapLeaf(std::unique_ptr<Node>& other) { leaf_.swap(other); }
     ChildrenArray children_;
     std::unique_ptr<Node> leaf_;
+    std::unique_ptr<ChildrenTree> childrenTree_;
+};
+
+// The Merkle tree that binary and radix16 branch nodes build over their 256 children. Level 0 holds
+// the child hashes, each level above holds one entry per arity entries of the one below, up to a
+// single root. An entry whose entries below are all empty is empty itself, any other is the SHA-256
+// of their hashes with kNullNodeHash for the empty ones.
+class ChildrenTree {
+   public:
+    explicit ChildrenTree(BranchHashing hashing);
+
+    BranchHashing hashing() const { return hashing_; }
+    // entries per block, 2 or 16
+    static size_t arity(BranchHashing hashing) { return hashing == BranchHashing::binary ? 2 : 16; }
+    // the sibling hashes of a child up to the root, arity - 1 per level above the children
+    static size_t numSiblings(BranchHashing hashing) {
+        return hashing == BranchHashing::binary ? 8 : 2 * 15;
+    }
+
+    // Takes the child hashes, null for empty children, and rehashes the entries above the ones
+    // that changed since the last update. Returns the root, null when every child is empty.
+    const unsigned char* update(const BranchNode::ChildHashes& childHashes);
+    // back to every entry empty
+    void clear() { std::fill(present_.begin(), present_.end(), 0); }
+    const unsigned char* root() const { return entry(hashes_.size() - 1); }
+    // Appends the siblings of child, from the level of the children up, null for empty ones. They
+    // point into the tree and are valid until the next update.
+    void siblings(Byte child, std::vector<const unsigned char*>& out) const;
+
+    // The root of a tree that holds childHash at child and siblings, as given by siblings, around
+    // it. Returns out or null when all of them are empty.
+    static const unsigned char* foldPath(BranchHashing hashing, Byte child,
+                                         const unsigned char* childHash,
+                                         std::span<const unsigned char* const> siblings,
+                                         unsigned char* out);
+
+   private:
+    using Hash = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+    // The entry over entries, into out. Returns out or null when they are all empty.
+    static const unsigned char* hashBlock(std::span<const unsigned char* const> entries,
+                                          unsigned char* out);
+    const unsigned char* entry(size_t index) const {
+        return present_[index] ? hashes_[index].data() : nullptr;
+    }
+
+    BranchHashing hashing_;
+    size_t arity_;
+    // the entries level after level, from the children up to the root
+    std::vector<Hash> hashes_;
+    std::vector<uint8_t> present_;
 };
 
 };  // namespace merkle
\ No newline at end of file
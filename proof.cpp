@@ -0,0 +1,511 @@
+#include "proof.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stack>
+#include <unordered_map>
+
+#include "detail/thread_pool.hpp"
+
+namespace merkle {
+
+namespace {
+
+void appendSize(ByteSequence& out, uint64_t size) {
+    // same native encoding as Node::serialize
+    auto* pSize = reinterpret_cast<Byte*>(&size);
+    out.insert(out.end(), pSize, pSize + Node::kSizeField);
+}
+
+bool readSize(ByteSequenceView in, size_t& pos, uint64_t& size) {
+    if (in.size() - pos < Node::kSizeField) {
+        return false;
+    }
+    std::memcpy(&size, in.data() + pos, Node::kSizeField);
+    pos += Node::kSizeField;
+    return true;
+}
+
+bool readBytes(ByteSequenceView in, size_t& pos, ByteSequence& out) {
+    uint64_t size = 0;
+    if (!readSize(in, pos, size) || in.size() - pos < size) {
+        return false;
+    }
+    out.assign(in.begin() + pos, in.begin() + pos + size);
+    pos += size;
+    return true;
+}
+
+// Follows key down from root the way Tree::find does and returns its leaf, or null when the key is
+// absent or its path leaves the known nodes. getNode(dbKey) returns the branch node under a db key
+// or null, visit(dbKey, node) is called on every branch node on the path, the root has an empty db
+// key.
+template <typename GetNode, typename Visit>
+const Node* walkPath(ByteSequenceView key, const BranchNode* root, GetNode&& getNode,
+                     Visit&& visit) {
+    const auto* branchNode = root;
+    ByteSequenceView dbKey;
+    ExtensionView extension{key};
+    while (branchNode != nullptr) {
+        visit(dbKey, *branchNode);
+        auto [result, matchBytes] = extension.compareTo(branchNode->extension());
+        if (result == ExtensionView::CompareResultType::equals) {
+            return branchNode->getChildAt(BranchNode::LeafChildPos).get();
+        }
+        if (result != ExtensionView::CompareResultType::contains_other_extension) {
+            return nullptr;
+        }
+        extension.incrementPositionBy(matchBytes);
+        auto currentByte = *extension.getCurrentByte();
+        extension.incrementPositionBy(1);
+        const auto& child = branchNode->getChildAt(currentByte);
+        if (child == nullptr) {
+            return nullptr;
+        }
+        if (child->getType() == Node::Type::HashOfBranch) {
+            dbKey = extension.getKeySoFar();
+            branchNode = getNode(dbKey);
+            continue;
+        }
+        auto [leafResult, leafMatchBytes] = extension.compareTo(child->extension());
+        return leafResult == ExtensionView::CompareResultType::equals ? child.get() : nullptr;
+    }
+    return nullptr;
+}
+
+void addPath(const Tree& tree, ByteSequenceView key, Proof& proof) {
+    walkPath(
+        key, tree.getRootNode().get(),
+        [&tree](ByteSequenceView dbKey) { return tree.getBranchNode(dbKey).get(); },
+        [&proof](ByteSequenceView dbKey, const BranchNode& node) {
+            // upper nodes are shared by most keys, serialize each once
+            if (proof.nodes.find(dbKey) != proof.nodes.end()) {
+                return;
+            }
+            ByteSequence bytes;
+            node.serialize(bytes);
+            proof.nodes.emplace(ByteSequence{dbKey.begin(), dbKey.end()}, std::move(bytes));
+        });
+}
+
+std::unique_ptr<BranchNode> hashNode(const ByteSequence& bytes, BranchHashing branchHashing) {
+    auto node = BranchNode::deserializeCommitted(bytes);
+    if (node == nullptr) {
+        return nullptr;
+    }
+    // the hash that came with the node is not trusted, rebuild it from the children hashes. The
+    // static computeHash keeps no ChildrenTree around, the node is not hashed again.
+    const auto& leaf = node->getChildAt(BranchNode::LeafChildPos);
+    BranchNode::computeHash(leaf == nullptr ? nullptr : leaf->hash(), node->childHashes(),
+                            node->getMutableHash(), branchHashing);
+    return node;
+}
+
+// Hashed proof nodes shared by the verifying threads. Entries are found by the hash the node
+// claims in its bytes and only reused when the bytes are identical, so a forged node never gets
+// another node's hash. Striped locks keep the threads mostly off each other's way.
+class NodeCache {
+   public:
+    explicit NodeCache(BranchHashing branchHashing) : branchHashing_(branchHashing) {}
+
+    std::shared_ptr<const BranchNode> get(const ByteSequence& bytes) {
+        if (bytes.size() < 1 + SHA256_DIGEST_LENGTH) {
+            return nullptr;
+        }
+        HashKey claimed;
+        std::memcpy(claimed.data(), bytes.data() + 1, SHA256_DIGEST_LENGTH);
+        auto& stripe = stripes_[claimed[0] % kStripes];
+        {
+            std::lock_guard lock(stripe.mutex);
+            auto itr = stripe.entries.find(claimed);
+            if (itr != stripe.entries.end() && itr->second.bytes == bytes) {
+                reused_.fetch_add(1, std::memory_order_relaxed);
+                return itr->second.node;
+            }
+        }
+        // hash outside of the lock, two threads may race on the same node and both hash it
+        std::shared_ptr<const BranchNode> node = hashNode(bytes, branchHashing_);
+        hashed_.fetch_add(1, std::memory_order_relaxed);
+        if (node != nullptr) {
+            std::lock_guard lock(stripe.mutex);
+            stripe.entries.try_emplace(claimed, Entry{bytes, node});
+        }
+        return node;
+    }
+
+    size_t hashed() const { return hashed_.load(); }
+    size_t reused() const { return reused_.load(); }
+
+   private:
+    using HashKey = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+    struct HashKeyHasher {
+        size_t operator()(const HashKey& key) const {
+            size_t h;
+            std::memcpy(&h, key.data(), sizeof(h));
+            return h;
+        }
+    };
+    struct Entry {
+        ByteSequence bytes;
+        std::shared_ptr<const BranchNode> node;
+    };
+    struct Stripe {
+        std::mutex mutex;
+        std::unordered_map<HashKey, Entry, HashKeyHasher> entries;
+    };
+    static constexpr size_t kStripes = 64;
+    BranchHashing branchHashing_;
+    std::array<Stripe, kStripes> stripes_;
+    std::atomic<size_t> hashed_{0};
+    std::atomic<size_t> reused_{0};
+};
+
+// loadNode(bytes) returns the branch node of the bytes with its hash computed, or null when the
+// bytes are not a branch node.
+template <typename LoadNode>
+bool verifyWith(const unsigned char* rootHash, const Proof& proof,
+                std::span<const KeyValueView> kvs, LoadNode&& loadNode) {
+    std::vector<std::shared_ptr<const BranchNode>> owned;
+    owned.reserve(proof.nodes.size());
+    std::map<ByteSequenceView, const BranchNode*, LessThan> nodes;
+    for (const auto& [dbKey, bytes] : proof.nodes) {
+        owned.push_back(loadNode(bytes));
+        if (owned.back() == nullptr) {
+            return false;
+        }
+        nodes.emplace(ByteSequenceToView(dbKey), owned.back().get());
+    }
+    auto rootItr = nodes.find(ByteSequenceView{});
+    if (rootItr == nodes.end() || !compareHashes(rootItr->second->hash(), rootHash)) {
+        return false;
+    }
+
+    // Every other node must hash to the HashOfBranch that its parent holds for it.
+    size_t chained = 1;
+    std::stack<std::pair<ByteSequenceView, const BranchNode*>> pending;
+    pending.emplace(*rootItr);
+    ByteSequence prefix;
+    while (!pending.empty()) {
+        auto [dbKey, node] = pending.top();
+        pending.pop();
+        prefix.assign(dbKey.begin(), dbKey.end());
+        prefix.insert(prefix.end(), node->extension().begin(), node->extension().end());
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            if (node->getTypeOfChild(byte) != Node::Type::HashOfBranch) {
+                continue;
+            }
+            prefix.push_back(byte);
+            auto childItr = nodes.find(prefix);
+            prefix.pop_back();
+            if (childItr == nodes.end()) {
+                continue;
+            }
+            if (!compareHashes(node->getChildAt(byte)->hash(), childItr->second->hash())) {
+                return false;
+            }
+            ++chained;
+            pending.emplace(*childItr);
+        }
+    }
+    if (chained != nodes.size()) {
+        return false;
+    }
+
+    unsigned char leafHash[SHA256_DIGEST_LENGTH];
+    for (const auto& [key, value] : kvs) {
+        const auto* leaf = walkPath(
+            key, rootItr->second,
+            [&nodes](ByteSequenceView dbKey) -> const BranchNode* {
+                auto itr = nodes.find(dbKey);
+                return itr == nodes.end() ? nullptr : itr->second;
+            },
+            [](ByteSequenceView, const BranchNode&) {});
+        if (leaf == nullptr) {
+            return false;
+        }
+        HashOfLeaf::computeHash(key, value, leafHash);
+        if (!compareHashes(leaf->hash(), leafHash)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the top bit of a PathProof step's map
+constexpr uint32_t kLeafSlotStep = uint32_t{1} << 31;
+
+const unsigned char* hashOrNull(const std::optional<PathProof::Hash>& hash) {
+    return hash ? hash->data() : nullptr;
+}
+
+std::optional<PathProof::Hash> optionalHash(const unsigned char* hash) {
+    if (hash == nullptr) {
+        return std::nullopt;
+    }
+    PathProof::Hash copy;
+    std::memcpy(copy.data(), hash, SHA256_DIGEST_LENGTH);
+    return copy;
+}
+
+}  // namespace
+
+size_t Proof::byteSize() const {
+    size_t size = Node::kSizeField;
+    for (const auto& [dbKey, bytes] : nodes) {
+        size += 2 * Node::kSizeField + dbKey.size() + bytes.size();
+    }
+    return size;
+}
+
+void Proof::serialize(ByteSequence& out) const {
+    out.reserve(out.size() + byteSize());
+    appendSize(out, nodes.size());
+    for (const auto& [dbKey, bytes] : nodes) {
+        appendSize(out, dbKey.size());
+        out.insert(out.end(), dbKey.begin(), dbKey.end());
+        appendSize(out, bytes.size());
+        out.insert(out.end(), bytes.begin(), bytes.end());
+    }
+}
+
+std::optional<Proof> Proof::deserialize(ByteSequenceView in) {
+    Proof proof;
+    size_t pos = 0;
+    uint64_t count = 0;
+    if (!readSize(in, pos, count)) {
+        return std::nullopt;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        ByteSequence dbKey;
+        ByteSequence bytes;
+        if (!readBytes(in, pos, dbKey) || !readBytes(in, pos, bytes)) {
+            return std::nullopt;
+        }
+        proof.nodes.emplace(std::move(dbKey), std::move(bytes));
+    }
+    if (pos != in.size()) {
+        return std::nullopt;
+    }
+    return proof;
+}
+
+Proof generateProof(const Tree& tree, ByteSequenceView key) {
+    Proof proof;
+    addPath(tree, key, proof);
+    return proof;
+}
+
+Proof generateMultiProof(const Tree& tree, std::span<const ByteSequence> keys) {
+    Proof proof;
+    for (const auto& key : keys) {
+        addPath(tree, key, proof);
+    }
+    return proof;
+}
+
+bool verifyProof(const unsigned char* rootHash, const Proof& proof,
+                 std::span<const KeyValueView> kvs, BranchHashing branchHashing) {
+    return verifyWith(rootHash, proof, kvs, [branchHashing](const ByteSequence& bytes) {
+        std::shared_ptr<const BranchNode> node = hashNode(bytes, branchHashing);
+        return node;
+    });
+}
+
+size_t PathProof::byteSize() const {
+    size_t size = Node::kSizeField;
+    for (const auto& step : steps) {
+        size += Node::kSizeField + sizeof(uint32_t);
+        size += step.other ? SHA256_DIGEST_LENGTH : 0;
+        for (const auto& sibling : step.siblings) {
+            size += sibling ? SHA256_DIGEST_LENGTH : 0;
+        }
+    }
+    return size;
+}
+
+void PathProof::serialize(ByteSequence& out) const {
+    out.reserve(out.size() + byteSize());
+    appendSize(out, steps.size());
+    for (const auto& step : steps) {
+        appendSize(out, step.position);
+        uint32_t map = step.siblings.empty() ? kLeafSlotStep : 0;
+        map |= step.other ? 1 : 0;
+        for (size_t i = 0; i < step.siblings.size(); ++i) {
+            map |= step.siblings[i] ? uint32_t{1} << (i + 1) : 0;
+        }
+        auto* pMap = reinterpret_cast<const Byte*>(&map);
+        out.insert(out.end(), pMap, pMap + sizeof(map));
+        auto append = [&out](const std::optional<Hash>& hash) {
+            if (hash) {
+                out.insert(out.end(), hash->begin(), hash->end());
+            }
+        };
+        append(step.other);
+        for (const auto& sibling : step.siblings) {
+            append(sibling);
+        }
+    }
+}
+
+std::optional<PathProof> PathProof::deserialize(ByteSequenceView in,
+                                                BranchHashing branchHashing) {
+    assert(branchHashing != BranchHashing::flat);
+    auto numSiblings = ChildrenTree::numSiblings(branchHashing);
+    PathProof proof;
+    size_t pos = 0;
+    uint64_t count = 0;
+    if (!readSize(in, pos, count)) {
+        return std::nullopt;
+    }
+    auto readHash = [&in, &pos](bool present, std::optional<Hash>& hash) {
+        if (!present) {
+            return true;
+        }
+        if (in.size() - pos < SHA256_DIGEST_LENGTH) {
+            return false;
+        }
+        hash.emplace();
+        std::memcpy(hash->data(), in.data() + pos, SHA256_DIGEST_LENGTH);
+        pos += SHA256_DIGEST_LENGTH;
+        return true;
+    };
+    for (uint64_t i = 0; i < count; ++i) {
+        auto& step = proof.steps.emplace_back();
+        uint32_t map = 0;
+        if (!readSize(in, pos, step.position) || in.size() - pos < sizeof(map)) {
+            return std::nullopt;
+        }
+        std::memcpy(&map, in.data() + pos, sizeof(map));
+        pos += sizeof(map);
+        // a leaf slot has other alone, a child other and its siblings
+        auto usedBits =
+            (map & kLeafSlotStep) ? kLeafSlotStep | 1 : (uint32_t{2} << numSiblings) - 1;
+        if ((map & ~usedBits) != 0 || !readHash(map & 1, step.other)) {
+            return std::nullopt;
+        }
+        if (!(map & kLeafSlotStep)) {
+            step.siblings.resize(numSiblings);
+            for (size_t s = 0; s < numSiblings; ++s) {
+                if (!readHash(map & (uint32_t{1} << (s + 1)), step.siblings[s])) {
+                    return std::nullopt;
+                }
+            }
+        }
+    }
+    if (pos != in.size()) {
+        return std::nullopt;
+    }
+    return proof;
+}
+
+std::optional<PathProof> generatePathProof(const Tree& tree, ByteSequenceView key) {
+    auto branchHashing = tree.branchHashing();
+    assert(branchHashing != BranchHashing::flat);
+    PathProof proof;
+    // for the nodes that keep no ChildrenTree of their own
+    ChildrenTree scratch(branchHashing);
+    std::vector<const unsigned char*> siblings;
+    const auto* leaf = walkPath(
+        key, tree.getRootNode().get(),
+        [&tree](ByteSequenceView dbKey) { return tree.getBranchNode(dbKey).get(); },
+        [&](ByteSequenceView dbKey, const BranchNode& node) {
+            const auto* childrenTree = node.childrenTree();
+            if (childrenTree == nullptr) {
+                scratch.clear();
+                scratch.update(node.childHashes());
+                childrenTree = &scratch;
+            }
+            auto& step = proof.steps.emplace_back();
+            step.position = dbKey.size() + node.extension().size();
+            if (step.position >= key.size()) {
+                step.other = optionalHash(childrenTree->root());
+                return;
+            }
+            const auto& leafSlot = node.getChildAt(BranchNode::LeafChildPos);
+            step.other = optionalHash(leafSlot == nullptr ? nullptr : leafSlot->hash());
+            siblings.clear();
+            childrenTree->siblings(key[step.position], siblings);
+            for (const auto* sibling : siblings) {
+                step.siblings.push_back(optionalHash(sibling));
+            }
+        });
+    if (leaf == nullptr) {
+        return std::nullopt;
+    }
+    return proof;
+}
+
+bool verifyPathProof(const unsigned char* rootHash, const PathProof& proof, KeyValueView kv,
+                     BranchHashing branchHashing) {
+    assert(branchHashing != BranchHashing::flat);
+    const auto& [key, value] = kv;
+    const auto& steps = proof.steps;
+    // the root's path is empty
+    if (steps.empty() || steps.front().position != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const auto& step = steps[i];
+        if (i > 0 && step.position <= steps[i - 1].position) {
+            return false;
+        }
+        bool isLeafSlot = step.position == key.size();
+        if (step.position > key.size() || (isLeafSlot && i + 1 != steps.size()) ||
+            step.siblings.size() != (isLeafSlot ? 0 : ChildrenTree::numSiblings(branchHashing))) {
+            return false;
+        }
+    }
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    unsigned char childrenRoot[SHA256_DIGEST_LENGTH];
+    std::vector<const unsigned char*> siblings;
+    HashOfLeaf::computeHash(key, value, hash);
+    for (auto step = steps.rbegin(); step != steps.rend(); ++step) {
+        if (step->position == key.size()) {
+            BranchNode::computeHash(hash, hashOrNull(step->other), hash);
+            continue;
+        }
+        siblings.clear();
+        for (const auto& sibling : step->siblings) {
+            siblings.push_back(hashOrNull(sibling));
+        }
+        const auto* root = ChildrenTree::foldPath(branchHashing, key[step->position], hash,
+                                                  siblings, childrenRoot);
+        BranchNode::computeHash(hashOrNull(step->other), root, hash);
+    }
+    return compareHashes(hash, rootHash);
+}
+
+BatchVerifyResult verifyProofs(const unsigned char* rootHash, std::span<const ProofItem> items,
+                               size_t numThreads, BranchHashing branchHashing) {
+    BatchVerifyResult result;
+    NodeCache cache(branchHashing);
+    std::vector<uint8_t> verified(items.size(), 0);
+    {
+        ThreadPool pool(numThreads);
+        // several chunks per thread so that a slow chunk does not hold the batch
+        size_t chunkSize = std::max<size_t>(1, items.size() / (pool.size() * 8));
+        std::vector<std::future<void>> pending;
+        for (size_t begin = 0; begin < items.size(); begin += chunkSize) {
+            auto end = std::min(begin + chunkSize, items.size());
+            pending.push_back(pool.submit([&, begin, end] {
+                auto loadNode = [&cache](const ByteSequence& bytes) { return cache.get(bytes); };
+                for (size_t i = begin; i < end; ++i) {
+                    KeyValueView kv{items[i].key, items[i].value};
+                    verified[i] = verifyWith(rootHash, *items[i].proof, std::span{&kv, 1}, loadNode);
+                }
+            }));
+        }
+        for (auto& future : pending) {
+            future.get();
+        }
+    }
+    result.verified.assign(verified.begin(), verified.end());
+    result.nodesHashed = cache.hashed();
+    result.nodesReused = cache.reused();
+    return result;
+}
+
+};  // namespace merkle
@@ -0,0 +1,106 @@
+#include <optional>
+#include <span>
+#include <thread>
+#include <utility>
+
+#include "tree.hpp"
+
+#pragma once
+
+namespace merkle {
+
+// The branch nodes on the paths to a set of keys, each serialized once however many of the keys
+// go through it.
+struct Proof {
+    // serialized branch nodes by db key, the root is under the empty key which no other node has
+    std::map<ByteSequence, ByteSequence, LessThan> nodes;
+
+    // bytes on the wire, see serialize
+    size_t byteSize() const;
+    // node count followed by length prefixed db key and node pairs, in db key order
+    void serialize(ByteSequence& out) const;
+    // nullopt when in is truncated or has trailing bytes. The node bytes are taken as is, the
+    // verifier rejects the ones that are not well formed serialized branch nodes.
+    static std::optional<Proof> deserialize(ByteSequenceView in);
+};
+
+using KeyValueView = std::pair<ByteSequenceView, ByteSequenceView>;
+
+// The tree must be committed with calculateHash. Keys that are not in the tree get the nodes on
+// their path up to where the lookup ends, a verifier will reject them as members.
+Proof generateProof(const Tree& tree, ByteSequenceView key);
+Proof generateMultiProof(const Tree& tree, std::span<const ByteSequence> keys);
+
+// Rebuilds the hashes of the proof nodes bottom up and checks that they chain to rootHash and that
+// every (key, value) pair is a leaf below them. Proofs with nodes unreachable from the root are
+// rejected. Extensions are not part of the hashes, membership holds because a leaf hash commits to
+// its full key, absence can't be proven. branchHashing is the one of the tree.
+bool verifyProof(const unsigned char* rootHash, const Proof& proof,
+                 std::span<const KeyValueView> kvs,
+                 BranchHashing branchHashing = BranchHashing::flat);
+
+struct ProofItem {
+    ByteSequenceView key;
+    ByteSequenceView value;
+    const Proof* proof;
+};
+
+struct BatchVerifyResult {
+    // one per item, in item order
+    std::vector<bool> verified;
+    // proof nodes hashed, and proof nodes found already hashed by an earlier proof
+    size_t nodesHashed = 0;
+    size_t nodesReused = 0;
+
+    bool allVerified() const {
+        return std::all_of(verified.begin(), verified.end(), [](bool v) { return v; });
+    }
+};
+
+// Verifies each item as verifyProof would, across numThreads threads. A node that appears in
+// several proofs with the same bytes, e.g. the root and the upper levels, is hashed once for the
+// whole batch.
+BatchVerifyResult verifyProofs(const unsigned char* rootHash, std::span<const ProofItem> items,
+                               size_t numThreads = std::thread::hardware_concurrency(),
+                               BranchHashing branchHashing = BranchHashing::flat);
+
+// The proof of a single key for a binary or radix16 tree, made of sibling hashes only rather than
+// whole branch nodes: per branch node on the path the hash of its other half, i.e. the leaf slot
+// when the path goes on through a child and the ChildrenTree root when it ends in the leaf slot,
+// and the ChildrenTree siblings of the child. A step takes up to 8 or 30 hashes where a Proof
+// takes every child of the node with its extension.
+struct PathProof {
+    using Hash = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+    struct Step {
+        // the length of the node's full path, i.e. db key and extension: the path goes on through
+        // child key[position], or ends in the leaf slot when position is the key's size
+        uint64_t position = 0;
+        // nullopt for empty ones
+        std::optional<Hash> other;
+        // ChildrenTree::numSiblings of them from the children up for a child, none for the leaf
+        // slot
+        std::vector<std::optional<Hash>> siblings;
+    };
+    // from the root down
+    std::vector<Step> steps;
+
+    // bytes on the wire, see serialize
+    size_t byteSize() const;
+    // Step count, then per step the position, a 32 bit map and the hashes that are not empty. Bit 0
+    // stands for other, the next ones for the siblings, and the top bit is set when the step ends
+    // in the leaf slot. Empty hashes take a bit and no bytes.
+    void serialize(ByteSequence& out) const;
+    // nullopt when in is truncated, has trailing bytes or does not fit branchHashing
+    static std::optional<PathProof> deserialize(ByteSequenceView in, BranchHashing branchHashing);
+};
+
+// The tree must be committed with calculateHash and be binary or radix16. nullopt when key is not
+// in the tree.
+std::optional<PathProof> generatePathProof(const Tree& tree, ByteSequenceView key);
+
+// Hashes (key, value) up the steps of proof and checks that it gives rootHash. Positions must grow
+// along the path and stay within the key, only the last step may end in the leaf slot.
+bool verifyPathProof(const unsigned char* rootHash, const PathProof& proof, KeyValueView kv,
+                     BranchHashing branchHashing);
+
+};  // namespace merkle
@@ -0,0 +1,153 @@
+#include "pruner.hpp"
+
+namespace merkle {
+
+Pruner::Pruner(NodeLog& log, size_t retainRoots, uint64_t readBytesPerSecond)
+    : log_(log), retainRoots_(retainRoots), throttle_(readBytesPerSecond) {
+    assert(retainRoots > 0);
+    start();
+}
+
+void Pruner::start() {
+    phase_ = Phase::mark;
+    generation_ = log_.generation();
+    pendingMarks_.clear();
+    markedOffsets_.clear();
+    sweepCursor_.reset();
+    result_ = PruneResult{};
+    auto versions = log_.versions();
+    if (versions.empty()) {
+        phase_ = Phase::done;
+        return;
+    }
+    newestVersion_ = versions.back();
+    auto firstRetained = versions.size() > retainRoots_ ? versions.size() - retainRoots_ : 0;
+    droppedVersions_.assign(versions.begin(), versions.begin() + firstRetained);
+    for (auto itr = versions.begin() + firstRetained; itr != versions.end(); ++itr) {
+        pendingMarks_.emplace_back(ByteSequence{}, *itr);
+    }
+}
+
+bool Pruner::step(size_t maxRecords) {
+    size_t budget = maxRecords;
+    while (phase_ == Phase::mark && budget > 0) {
+        if (pendingMarks_.empty()) {
+            startSweep();
+            break;
+        }
+        auto [dbKey, version] = std::move(pendingMarks_.back());
+        pendingMarks_.pop_back();
+        auto location = log_.locate(dbKey, version);
+        assert(location.has_value());
+        if (location && location->generation != generation_) {
+            // compacted meanwhile, the marked offsets are stale
+            start();
+            continue;
+        }
+        // a record reached again, from another version or parent, has the same subtree below it
+        if (!location || !markedOffsets_.insert(location->offset).second) {
+            continue;
+        }
+        --budget;
+        ++result_.recordsMarked;
+        auto bytes = log_.readNode(*location);
+        if (!bytes) {
+            start();
+            continue;
+        }
+        throttle_.consume(bytes->size());
+        result_.bytesRead += bytes->size();
+        auto node = BranchNode::deserializeCommitted(*bytes);
+        if (node == nullptr) {
+            // a corrupt record has no children to follow
+            continue;
+        }
+        dbKey.insert(dbKey.end(), node->extension().begin(), node->extension().end());
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            if (node->getTypeOfChild(byte) != Node::Type::HashOfBranch) {
+                continue;
+            }
+            auto childKey = dbKey;
+            childKey.push_back(byte);
+            pendingMarks_.emplace_back(std::move(childKey), version);
+        }
+    }
+    if (phase_ == Phase::sweep && budget > 0) {
+        std::unique_lock lock(log_.mutex_);
+        if (log_.generation_ != generation_) {
+            lock.unlock();
+            start();
+            return false;
+        }
+        auto& index = log_.index_;
+        auto itr = sweepCursor_ ? index.upper_bound(*sweepCursor_) : index.begin();
+        for (; itr != index.end() && budget > 0; --budget) {
+            auto& versions = itr->second;
+            for (auto versionItr = versions.begin();
+                 versionItr != versions.end() && versionItr->first <= newestVersion_;) {
+                const auto& location = versionItr->second;
+                if (markedOffsets_.contains(location.offset)) {
+                    ++versionItr;
+                    continue;
+                }
+                ++result_.recordsReclaimed;
+                result_.bytesReclaimed += location.recordSize();
+                log_.liveBytes_ -= location.recordSize();
+                versionItr = versions.erase(versionItr);
+            }
+            sweepCursor_ = itr->first;
+            itr = versions.empty() ? index.erase(itr) : std::next(itr);
+        }
+        if (itr == index.end()) {
+            for (auto version : droppedVersions_) {
+                log_.versions_.erase(version);
+            }
+            result_.versionsDropped = droppedVersions_.size();
+            phase_ = Phase::done;
+        }
+    }
+    return phase_ == Phase::done;
+}
+
+void Pruner::startSweep() {
+    pendingMarks_.clear();
+    pendingMarks_.shrink_to_fit();
+    phase_ = Phase::sweep;
+}
+
+namespace {
+// pause between two passes of the background pruner
+constexpr auto kPassInterval = std::chrono::milliseconds(50);
+}  // namespace
+
+BackgroundPruner::BackgroundPruner(NodeLog& log, size_t retainRoots,
+                                   uint64_t readBytesPerSecond) {
+    thread_ = std::thread([this, &log, retainRoots, readBytesPerSecond] {
+        while (!stopping_.load()) {
+            Pruner pruner(log, retainRoots, readBytesPerSecond);
+            while (!stopping_.load() && !pruner.step(Pruner::kStepRecords)) {
+            }
+            if (!pruner.done()) {
+                return;
+            }
+            bytesReclaimed_.fetch_add(pruner.result().bytesReclaimed);
+            passes_.fetch_add(1);
+            std::unique_lock lock(mutex_);
+            wakeUp_.wait_for(lock, kPassInterval, [this] { return stopping_.load(); });
+        }
+    });
+}
+
+void BackgroundPruner::stop() {
+    {
+        std::lock_guard lock(mutex_);
+        stopping_.store(true);
+    }
+    wakeUp_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+};  // namespace merkle
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "detail/throttle.hpp"
+#include "node_log.hpp"
+
+#pragma once
+
+namespace merkle {
+
+struct PruneResult {
+    // versions older than the retained ones, dropped from the log
+    size_t versionsDropped = 0;
+    // records reachable from the retained versions
+    size_t recordsMarked = 0;
+    size_t recordsReclaimed = 0;
+    uint64_t bytesReclaimed = 0;
+    // node bytes read while marking
+    uint64_t bytesRead = 0;
+};
+
+// Drops the records that no longer belong to one of the newest retainRoots versions of a NodeLog.
+// A pass marks the records reachable from the retained roots, reading each distinct record once,
+// then sweeps the unmarked ones out of the index. Their bytes become dead bytes of the log file
+// until it is compacted. The pass is done in bounded steps so it can share a thread with other
+// work, reads are paced to readBytesPerSecond (0 for no limit). Commits may go on meanwhile, the
+// versions they add are left alone. A compaction in the middle of a pass restarts it.
+class Pruner {
+   public:
+    Pruner(NodeLog& log, size_t retainRoots, uint64_t readBytesPerSecond = 0);
+
+    // Marks or sweeps up to maxRecords records, returns true once the pass is complete.
+    bool step(size_t maxRecords);
+    void run() {
+        while (!step(kStepRecords)) {
+        }
+    }
+    bool done() const { return phase_ == Phase::done; }
+    const PruneResult& result() const { return result_; }
+
+    static constexpr size_t kStepRecords = 64;
+
+   private:
+    enum class Phase : uint8_t { mark, sweep, done };
+
+    void start();
+    void startSweep();
+
+    NodeLog& log_;
+    size_t retainRoots_;
+    Throttle throttle_;
+    Phase phase_ = Phase::mark;
+    uint64_t generation_ = 0;
+    // the newest version when the pass started, newer records are never swept
+    uint64_t newestVersion_ = 0;
+    std::vector<uint64_t> droppedVersions_;
+    // db key and the version it is read at
+    std::vector<std::pair<ByteSequence, uint64_t>> pendingMarks_;
+    std::unordered_set<uint64_t> markedOffsets_;
+    // sweep resumes after this db key
+    std::optional<ByteSequence> sweepCursor_;
+    PruneResult result_;
+};
+
+// Runs pruning passes on a thread of its own, one after the other, until stopped. Meant to keep
+// the log trimmed as commits go on.
+class BackgroundPruner {
+   public:
+    BackgroundPruner(NodeLog& log, size_t retainRoots, uint64_t readBytesPerSecond = 0);
+    ~BackgroundPruner() { stop(); }
+    BackgroundPruner(const BackgroundPruner&) = delete;
+    BackgroundPruner& operator=(const BackgroundPruner&) = delete;
+
+    // Finishes the current step and joins the thread.
+    void stop();
+    size_t passes() const { return passes_.load(); }
+    uint64_t bytesReclaimed() const { return bytesReclaimed_.load(); }
+
+   private:
+    std::atomic<bool> stopping_{false};
+    std::atomic<size_t> passes_{0};
+    std::atomic<uint64_t> bytesReclaimed_{0};
+    std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    std::thread thread_;
+};
+
+};  // namespace merkle
@@ -0,0 +1,80 @@
+#include "sharded_tree.hpp"
+
+namespace merkle {
+
+ShardedTree::ShardedTree(Tree::LeafHashing leafHashing, size_t numThreads,
+                         Tree::BranchHashing branchHashing)
+    : branchHashing_(branchHashing), pool_(numThreads) {
+    for (auto& shard : shards_) {
+        shard = std::make_unique<Shard>(leafHashing, branchHashing);
+    }
+    calculateHash();
+}
+
+void ShardedTree::insert(ByteSequence&& key, ByteSequence&& value) {
+    auto& shard = *shards_[shardOf(key)];
+    std::lock_guard lock(shard.mutex);
+    shard.tree.insert(std::move(key), std::move(value));
+    shard.dirty = true;
+}
+
+void ShardedTree::insert(ByteSequenceView key, ByteSequenceView value) {
+    auto& shard = *shards_[shardOf(key)];
+    std::lock_guard lock(shard.mutex);
+    shard.tree.insert(key, value);
+    shard.dirty = true;
+}
+
+Tree::LookupResult ShardedTree::find(ByteSequenceView key) const {
+    const auto& shard = *shards_[shardOf(key)];
+    std::lock_guard lock(shard.mutex);
+    return shard.tree.find(key);
+}
+
+void ShardedTree::commitShard(Byte byte) {
+    auto& shard = *shards_[byte];
+    std::lock_guard lock(shard.mutex);
+    shard.tree.calculateHash();
+    shard.dirty = false;
+    const auto& root = shard.tree.getRootNode();
+    const auto& top = root->getChildAt(byte);
+    shard.hasTop = top != nullptr;
+    if (shard.hasTop) {
+        std::memcpy(shard.topHash, top->hash(), SHA256_DIGEST_LENGTH);
+    }
+    if (byte == 0) {
+        const auto& leaf = root->getChildAt(BranchNode::LeafChildPos);
+        hasLeaf_ = leaf != nullptr;
+        if (hasLeaf_) {
+            std::memcpy(leafHash_, leaf->hash(), SHA256_DIGEST_LENGTH);
+        }
+    }
+}
+
+const unsigned char* ShardedTree::calculateHash() {
+    std::vector<std::future<void>> pending;
+    for (size_t i = 0; i < kNumShards; ++i) {
+        auto byte = static_cast<Byte>(i);
+        bool dirty;
+        {
+            std::lock_guard lock(shards_[byte]->mutex);
+            dirty = shards_[byte]->dirty;
+        }
+        if (dirty) {
+            pending.push_back(pool_.submit([this, byte] { commitShard(byte); }));
+        }
+    }
+    for (auto& future : pending) {
+        future.get();
+    }
+    lastCommitShards_ = pending.size();
+
+    BranchNode::ChildHashes topHashes;
+    for (size_t i = 0; i < kNumShards; ++i) {
+        topHashes[i] = shards_[i]->hasTop ? shards_[i]->topHash : nullptr;
+    }
+    BranchNode::computeHash(hasLeaf_ ? leafHash_ : nullptr, topHashes, rootHash_, branchHashing_);
+    return rootHash_;
+}
+
+};  // namespace merkle
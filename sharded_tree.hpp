@@ -0,0 +1,72 @@
+#include <array>
+#include <mutex>
+#include <thread>
+
+#include "detail/thread_pool.hpp"
+#include "tree.hpp"
+
+#pragma once
+
+namespace merkle {
+
+// A tree split by the first key byte into kNumShards trees, each with its own lock and dirty
+// flag, so writers of different shards proceed in parallel. The empty key goes with shard 0.
+//
+// Shard b holds exactly the keys under child b of the unsharded root, so the top node of its
+// subtree hashes the same as there. The root hash is the branch node hash over the shards' top
+// hashes and is identical to the root hash of a Tree with the same keys.
+class ShardedTree {
+   public:
+    static constexpr size_t kNumShards = BranchNode::kBranchingFactor;
+
+    explicit ShardedTree(Tree::LeafHashing leafHashing = Tree::LeafHashing::eager,
+                         size_t numThreads = std::thread::hardware_concurrency(),
+                         Tree::BranchHashing branchHashing = Tree::BranchHashing::flat);
+
+    // Safe to call concurrently with each other and with calculateHash.
+    void insert(ByteSequence&& key, ByteSequence&& value);
+    void insert(ByteSequenceView key, ByteSequenceView value);
+    Tree::LookupResult find(ByteSequenceView key) const;
+
+    // Commits the shards written since the last call on the thread pool and hashes the root from
+    // their top hashes. Each shard is taken as of when it was committed, writes that race with
+    // calculateHash go into this root or the next one. Not to be called concurrently with itself.
+    const unsigned char* calculateHash();
+    // as of the last calculateHash
+    const unsigned char* rootHash() const { return rootHash_; }
+
+    // The shard of the keys that start with byte, the empty key is in shard 0. Only for use while
+    // nothing writes to it, e.g. to generate proofs: its nodes are those of the unsharded tree
+    // under child byte of the root.
+    const Tree& shard(Byte byte) const { return shards_[byte]->tree; }
+    size_t numThreads() const { return pool_.size(); }
+    // shards committed by the last calculateHash
+    size_t lastCommitShards() const { return lastCommitShards_; }
+
+   private:
+    struct Shard {
+        Shard(Tree::LeafHashing leafHashing, Tree::BranchHashing branchHashing)
+            : tree(leafHashing, Tree::UnchangedWrites::apply, branchHashing) {}
+
+        mutable std::mutex mutex;
+        Tree tree;
+        bool dirty = false;
+        // what the root holds for this shard as of its last commit
+        bool hasTop = false;
+        unsigned char topHash[SHA256_DIGEST_LENGTH] = {};
+    };
+
+    static Byte shardOf(ByteSequenceView key) { return key.empty() ? 0 : key[0]; }
+    void commitShard(Byte byte);
+
+    Tree::BranchHashing branchHashing_;
+    std::array<std::unique_ptr<Shard>, kNumShards> shards_;
+    // the empty key, kept with shard 0 and guarded by its mutex
+    bool hasLeaf_ = false;
+    unsigned char leafHash_[SHA256_DIGEST_LENGTH] = {};
+    unsigned char rootHash_[SHA256_DIGEST_LENGTH] = {};
+    size_t lastCommitShards_ = 0;
+    ThreadPool pool_;
+};
+
+};  // namespace merkle
@@ -0,0 +1,243 @@
+#include <deque>
+#include <istream>
+#include <ostream>
+
+#include "tree.hpp"
+
+namespace merkle {
+
+namespace {
+
+// version 2 added the branch hashing byte
+constexpr Byte kSnapshotMagic[Node::kSizeField] = {'K', 'V', 'M', 'S', 'N', 'A', 'P', 2};
+// larger records are taken as corrupt rather than allocated
+constexpr uint64_t kMaxSnapshotRecord = uint64_t{1} << 26;
+// nodes per hash check task
+constexpr size_t kHashCheckBatch = 256;
+
+class ChecksumWriter {
+   public:
+    explicit ChecksumWriter(std::ostream& out) : out_(out) { SHA256_Init(&sha_); }
+
+    void write(const Byte* data, size_t size) {
+        out_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        SHA256_Update(&sha_, data, size);
+    }
+    void writeSize(uint64_t size) { write(reinterpret_cast<const Byte*>(&size), Node::kSizeField); }
+    // writes the checksum of everything written so far
+    void finish() {
+        unsigned char checksum[SHA256_DIGEST_LENGTH];
+        SHA256_Final(checksum, &sha_);
+        out_.write(reinterpret_cast<const char*>(checksum), SHA256_DIGEST_LENGTH);
+    }
+
+   private:
+    std::ostream& out_;
+    SHA256_CTX sha_;
+};
+
+class ChecksumReader {
+   public:
+    explicit ChecksumReader(std::istream& in) : in_(in) { SHA256_Init(&sha_); }
+
+    bool read(Byte* data, size_t size) {
+        if (!in_.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(size))) {
+            return false;
+        }
+        SHA256_Update(&sha_, data, size);
+        return true;
+    }
+    bool readSize(uint64_t& size) {
+        return read(reinterpret_cast<Byte*>(&size), Node::kSizeField);
+    }
+    // reads the checksum that follows and compares it with the one of everything read so far
+    bool finish() {
+        unsigned char expected[SHA256_DIGEST_LENGTH];
+        unsigned char checksum[SHA256_DIGEST_LENGTH];
+        SHA256_Final(expected, &sha_);
+        return in_.read(reinterpret_cast<char*>(checksum), SHA256_DIGEST_LENGTH) &&
+               compareHashes(checksum, expected);
+    }
+
+   private:
+    std::istream& in_;
+    SHA256_CTX sha_;
+};
+
+bool hashesMatch(std::span<const BranchNode* const> nodes, BranchHashing branchHashing) {
+    for (const auto* node : nodes) {
+        const auto& leaf = node->getChildAt(BranchNode::LeafChildPos);
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        BranchNode::computeHash(leaf == nullptr ? nullptr : leaf->hash(), node->childHashes(), hash,
+                                branchHashing);
+        if (!compareHashes(hash, node->hash())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rehashes imported nodes in batches and remembers whether one of them had a wrong hash. With a
+// pool a few batches per thread are in flight, the oldest is waited for before adding more.
+class HashChecks {
+   public:
+    HashChecks(BranchHashing branchHashing, ThreadPool* pool)
+        : branchHashing_(branchHashing), pool_(pool) {}
+    ~HashChecks() {
+        // the batches point into the tree, which goes away after this
+        for (auto& future : inFlight_) {
+            future.wait();
+        }
+    }
+
+    void add(const BranchNode* node) {
+        batch_.push_back(node);
+        if (batch_.size() == kHashCheckBatch) {
+            flush();
+        }
+    }
+    // Waits for every check, true when all hashes matched.
+    bool finish() {
+        flush();
+        while (!inFlight_.empty()) {
+            collect();
+        }
+        return matched_;
+    }
+
+   private:
+    void flush() {
+        if (batch_.empty()) {
+            return;
+        }
+        if (pool_ == nullptr) {
+            matched_ = matched_ && hashesMatch(batch_, branchHashing_);
+            batch_.clear();
+            return;
+        }
+        if (inFlight_.size() >= 2 * pool_->size()) {
+            collect();
+        }
+        inFlight_.push_back(pool_->submit([batch = std::move(batch_), this] {
+            return hashesMatch(batch, branchHashing_);
+        }));
+        batch_.clear();
+    }
+    void collect() {
+        matched_ = inFlight_.front().get() && matched_;
+        inFlight_.pop_front();
+    }
+
+    BranchHashing branchHashing_;
+    ThreadPool* pool_;
+    std::vector<const BranchNode*> batch_;
+    std::deque<std::future<bool>> inFlight_;
+    bool matched_ = true;
+};
+
+}  // namespace
+
+bool Tree::exportSnapshot(std::ostream& out) const {
+    // stale hashes would be rejected by the import
+    if (rootDirty_) {
+        return false;
+    }
+    ChecksumWriter writer(out);
+    writer.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+    auto branchHashing = static_cast<Byte>(branchHashing_);
+    writer.write(&branchHashing, 1);
+    writer.write(root_->hash(), SHA256_DIGEST_LENGTH);
+    uint64_t numNodes = 0;
+    ByteSequence bytes;
+    auto writeNode = [&writer, &numNodes, &bytes](const BranchNode& node) {
+        bytes.clear();
+        node.serialize(bytes);
+        writer.writeSize(bytes.size());
+        writer.write(bytes.data(), bytes.size());
+        ++numNodes;
+    };
+    writeNode(*root_);
+    forEachBranchNode([&writeNode](ByteSequenceView, const BranchNode& node) { writeNode(node); });
+    writer.writeSize(0);
+    writer.writeSize(numNodes);
+    writer.finish();
+    return true;
+}
+
+std::optional<Tree> Tree::importSnapshot(std::istream& in, LeafHashing leafHashing,
+                                         ThreadPool* pool) {
+    ChecksumReader reader(in);
+    Byte magic[sizeof(kSnapshotMagic)];
+    Byte branchHashing;
+    unsigned char rootHash[SHA256_DIGEST_LENGTH];
+    if (!reader.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, kSnapshotMagic, sizeof(magic)) != 0 ||
+        !reader.read(&branchHashing, 1) ||
+        branchHashing > static_cast<Byte>(BranchHashing::radix16) ||
+        !reader.read(rootHash, SHA256_DIGEST_LENGTH)) {
+        return std::nullopt;
+    }
+    Tree tree(leafHashing, UnchangedWrites::apply, static_cast<BranchHashing>(branchHashing));
+    // destroyed first, it waits for the checks still reading the tree's nodes
+    HashChecks hashChecks(tree.branchHashing_, pool);
+    uint64_t numNodes = 0;
+    ByteSequence bytes;
+    // the next record, null at the end marker or when it is not a well formed node
+    auto readNode = [&reader, &numNodes, &bytes]() -> std::unique_ptr<BranchNode> {
+        uint64_t size;
+        if (!reader.readSize(size) || size == 0 || size > kMaxSnapshotRecord) {
+            return nullptr;
+        }
+        bytes.resize(size);
+        if (!reader.read(bytes.data(), size)) {
+            return nullptr;
+        }
+        ++numNodes;
+        return BranchNode::deserializeCommitted(bytes);
+    };
+
+    // the branch children of the nodes read so far that are still to come, the next one on top,
+    // with the HashOfBranch their parent holds for them
+    std::vector<std::pair<ByteSequence, const Node*>> expected;
+    auto expectChildren = [&expected](ByteSequence prefix, const BranchNode& node) {
+        prefix.insert(prefix.end(), node.extension().begin(), node.extension().end());
+        for (int i = std::numeric_limits<Byte>::max(); i >= 0; --i) {
+            auto byte = static_cast<Byte>(i);
+            if (node.getTypeOfChild(byte) == Node::Type::HashOfBranch) {
+                expected.emplace_back(prefix, node.getChildAt(byte).get());
+                expected.back().first.push_back(byte);
+            }
+        }
+    };
+
+    auto root = readNode();
+    if (root == nullptr || !compareHashes(root->hash(), rootHash) || !root->extension().empty()) {
+        return std::nullopt;
+    }
+    hashChecks.add(root.get());
+    tree.root_ = std::move(root);
+    tree.rootDirty_ = false;
+    expectChildren(ByteSequence{}, *tree.root_);
+    while (!expected.empty()) {
+        auto node = readNode();
+        auto [dbKey, hashOfBranch] = std::move(expected.back());
+        expected.pop_back();
+        if (node == nullptr || !compareHashes(node->hash(), hashOfBranch->hash()) ||
+            !std::ranges::equal(node->extension(), hashOfBranch->extension())) {
+            return std::nullopt;
+        }
+        hashChecks.add(node.get());
+        expectChildren(dbKey, *node);
+        tree.emplaceBranchNode(dbKey, std::move(node));
+    }
+
+    uint64_t endMarker;
+    uint64_t writtenNodes;
+    if (!reader.readSize(endMarker) || endMarker != 0 || !reader.readSize(writtenNodes) ||
+        writtenNodes != numNodes || !reader.finish() || !hashChecks.finish()) {
+        return std::nullopt;
+    }
+    return tree;
+}
+
+};  // namespace merkle
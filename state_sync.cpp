@@ -0,0 +1,381 @@
+#include "state_sync.hpp"
+
+namespace merkle {
+
+namespace {
+
+using LeafHash = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+void appendSize(ByteSequence& out, uint64_t size) {
+    auto* pSize = reinterpret_cast<Byte*>(&size);
+    out.insert(out.end(), pSize, pSize + Node::kSizeField);
+}
+
+void appendBytes(ByteSequence& out, ByteSequenceView bytes) {
+    appendSize(out, bytes.size());
+    out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+bool readSize(ByteSequenceView in, size_t& pos, uint64_t& size) {
+    if (in.size() - pos < Node::kSizeField) {
+        return false;
+    }
+    std::memcpy(&size, in.data() + pos, Node::kSizeField);
+    pos += Node::kSizeField;
+    return true;
+}
+
+bool readBytes(ByteSequenceView in, size_t& pos, ByteSequence& out) {
+    uint64_t size = 0;
+    if (!readSize(in, pos, size) || in.size() - pos < size) {
+        return false;
+    }
+    out.assign(in.begin() + pos, in.begin() + pos + size);
+    pos += size;
+    return true;
+}
+
+bool startsWith(ByteSequenceView key, ByteSequenceView prefix) {
+    return key.size() >= prefix.size() && std::equal(prefix.begin(), prefix.end(), key.begin());
+}
+
+ByteSequence pathOf(ByteSequenceView dbKey, const BranchNode& node) {
+    ByteSequence path{dbKey.begin(), dbKey.end()};
+    path.insert(path.end(), node.extension().begin(), node.extension().end());
+    return path;
+}
+
+// A slot of the upper nodes when splitting.
+struct PlannedSlot {
+    ByteSequence path;
+    // db key of the upper node holding it
+    ByteSequence parent;
+    // the leaf in the slot, or the top node of the subtree in it
+    const Node* leaf;
+    const BranchNode* subtree;
+    bool isLeafSlot;
+    size_t numKeys;
+};
+
+// Splits the branch nodes whose subtree has more than maxSlotKeys keys into their slots, top down.
+class SlotPlanner {
+   public:
+    SlotPlanner(const Tree& tree, size_t maxSlotKeys) : tree_(tree), maxSlotKeys_(maxSlotKeys) {}
+
+    void expand(const ByteSequence& dbKey, const BranchNode& node) {
+        auto path = pathOf(dbKey, node);
+        const auto& leaf = node.getChildAt(BranchNode::LeafChildPos);
+        if (leaf != nullptr) {
+            slots_.push_back(PlannedSlot{path, dbKey, leaf.get(), nullptr, true, 1});
+        }
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            const auto& child = node.getChildAt(byte);
+            if (child == nullptr) {
+                continue;
+            }
+            auto childKey = path;
+            childKey.push_back(byte);
+            if (child->getType() == Node::Type::HashOfLeaf) {
+                slots_.push_back(
+                    PlannedSlot{std::move(childKey), dbKey, child.get(), nullptr, false, 1});
+                continue;
+            }
+            const auto& branchNode = tree_.getBranchNode(childKey);
+            assert(branchNode != nullptr);
+            auto numKeys = countKeys(childKey, *branchNode);
+            if (numKeys <= maxSlotKeys_) {
+                slots_.push_back(PlannedSlot{std::move(childKey), dbKey, nullptr, branchNode.get(),
+                                             false, numKeys});
+                continue;
+            }
+            parents_.emplace(childKey, dbKey);
+            expand(childKey, *branchNode);
+        }
+    }
+
+    std::vector<PlannedSlot>& slots() { return slots_; }
+    // the upper node under dbKey and the one above it
+    const ByteSequence& parentOf(const ByteSequence& dbKey) const { return parents_.at(dbKey); }
+
+   private:
+    size_t countKeys(ByteSequenceView dbKey, const BranchNode& node) const {
+        size_t numKeys = 0;
+        auto path = pathOf(dbKey, node);
+        tree_.forEachLeaf(node, path, [&numKeys](ByteSequenceView, const Node&) { ++numKeys; });
+        return numKeys;
+    }
+
+    const Tree& tree_;
+    size_t maxSlotKeys_;
+    std::vector<PlannedSlot> slots_;
+    std::map<ByteSequence, ByteSequence, LessThan> parents_;
+};
+
+// A slot of the proof nodes that the chunk covers.
+struct CoveredSlot {
+    ByteSequence path;
+    const Node* node;
+    bool isLeafSlot;
+};
+
+// verifyChunk, with the hashes of chunk.kvs in leafHashes when the chunk verifies.
+bool checkChunk(const unsigned char* rootHash, const StateChunk& chunk,
+                BranchHashing branchHashing, std::vector<LeafHash>& leafHashes) {
+    LessThan less;
+    if (less(chunk.lastSlot, chunk.firstSlot)) {
+        return false;
+    }
+    std::map<ByteSequenceView, std::unique_ptr<BranchNode>, LessThan> nodes;
+    for (const auto& [dbKey, bytes] : chunk.proof.nodes) {
+        auto node = BranchNode::deserializeCommitted(bytes);
+        if (node == nullptr) {
+            return false;
+        }
+        // the hash that came with the node is not trusted, rebuild it from the children hashes
+        node->computeHash(branchHashing);
+        nodes.emplace(ByteSequenceToView(dbKey), std::move(node));
+    }
+    auto rootItr = nodes.find(ByteSequenceView{});
+    if (rootItr == nodes.end() || !compareHashes(rootItr->second->hash(), rootHash)) {
+        return false;
+    }
+
+    // Chain the proof nodes from the root and gather their slots within the chunk's range.
+    std::vector<CoveredSlot> covered;
+    auto cover = [&](ByteSequence&& path, const Node* node, bool isLeafSlot) {
+        if (!less(path, chunk.firstSlot) && !less(chunk.lastSlot, path)) {
+            covered.push_back(CoveredSlot{std::move(path), node, isLeafSlot});
+        }
+    };
+    size_t chained = 0;
+    std::vector<std::pair<ByteSequenceView, const BranchNode*>> pending{
+        {rootItr->first, rootItr->second.get()}};
+    while (!pending.empty()) {
+        auto [dbKey, node] = pending.back();
+        pending.pop_back();
+        ++chained;
+        auto path = pathOf(dbKey, *node);
+        const auto& leaf = node->getChildAt(BranchNode::LeafChildPos);
+        if (leaf != nullptr) {
+            cover(ByteSequence{path}, leaf.get(), true);
+        }
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            const auto& child = node->getChildAt(byte);
+            if (child == nullptr) {
+                continue;
+            }
+            auto childPath = path;
+            childPath.push_back(byte);
+            auto childItr = child->getType() == Node::Type::HashOfBranch ? nodes.find(childPath)
+                                                                          : nodes.end();
+            if (childItr == nodes.end()) {
+                cover(std::move(childPath), child.get(), false);
+                continue;
+            }
+            if (!compareHashes(child->hash(), childItr->second->hash())) {
+                return false;
+            }
+            pending.emplace_back(childItr->first, childItr->second.get());
+        }
+    }
+    if (chained != nodes.size() || covered.empty()) {
+        return false;
+    }
+    std::sort(covered.begin(), covered.end(),
+              [&less](const auto& lhs, const auto& rhs) { return less(lhs.path, rhs.path); });
+    if (covered.front().path != chunk.firstSlot || covered.back().path != chunk.lastSlot) {
+        return false;
+    }
+
+    // The subtrees are checked on a tree of the chunk's key values, a subtree's hash does not
+    // depend on what is above it.
+    const auto& kvs = chunk.kvs;
+    leafHashes.resize(kvs.size());
+    Tree chunkTree(branchHashing);
+    for (size_t k = 0; k < kvs.size(); ++k) {
+        if (k > 0 && !less(kvs[k - 1].first, kvs[k].first)) {
+            return false;
+        }
+        HashOfLeaf::computeHash(kvs[k].first, kvs[k].second, leafHashes[k].data());
+        chunkTree.insertLeafHash(kvs[k].first, leafHashes[k].data());
+    }
+    chunkTree.calculateHash();
+
+    // Both the slots and the keys are in key order, the keys of a slot are the next ones that
+    // start with its path.
+    size_t k = 0;
+    for (const auto& slot : covered) {
+        if (slot.node->getType() == Node::Type::HashOfLeaf) {
+            auto key = slot.path;
+            if (!slot.isLeafSlot) {
+                key.insert(key.end(), slot.node->extension().begin(), slot.node->extension().end());
+            }
+            if (k == kvs.size() || kvs[k].first != key ||
+                !compareHashes(leafHashes[k].data(), slot.node->hash())) {
+                return false;
+            }
+            ++k;
+            continue;
+        }
+        while (k < kvs.size() && startsWith(kvs[k].first, slot.path)) {
+            ++k;
+        }
+        auto subtreeKey = chunkTree.findSubtree(slot.path);
+        if (!subtreeKey ||
+            !compareHashes(chunkTree.getBranchNode(*subtreeKey)->hash(), slot.node->hash())) {
+            return false;
+        }
+    }
+    return k == kvs.size();
+}
+
+}  // namespace
+
+void StateChunk::serialize(ByteSequence& out) const {
+    appendBytes(out, firstSlot);
+    appendBytes(out, lastSlot);
+    appendSize(out, kvs.size());
+    for (const auto& [key, value] : kvs) {
+        appendBytes(out, key);
+        appendBytes(out, value);
+    }
+    proof.serialize(out);
+}
+
+std::optional<StateChunk> StateChunk::deserialize(ByteSequenceView in) {
+    StateChunk chunk;
+    size_t pos = 0;
+    uint64_t count = 0;
+    if (!readBytes(in, pos, chunk.firstSlot) || !readBytes(in, pos, chunk.lastSlot) ||
+        !readSize(in, pos, count)) {
+        return std::nullopt;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        ByteSequence key;
+        ByteSequence value;
+        if (!readBytes(in, pos, key) || !readBytes(in, pos, value)) {
+            return std::nullopt;
+        }
+        chunk.kvs.emplace_back(std::move(key), std::move(value));
+    }
+    auto proof = Proof::deserialize(in.subspan(pos));
+    if (!proof) {
+        return std::nullopt;
+    }
+    chunk.proof = std::move(*proof);
+    return chunk;
+}
+
+std::vector<StateChunk> splitIntoChunks(
+    const Tree& tree, size_t numChunks,
+    const std::function<ByteSequence(ByteSequenceView key)>& getValue) {
+    assert(numChunks > 0);
+    size_t numKeys = 0;
+    tree.forEachLeaf([&numKeys](ByteSequenceView, const Node&) { ++numKeys; });
+    SlotPlanner planner(tree, std::max<size_t>(1, (numKeys + numChunks - 1) / numChunks));
+    planner.expand(ByteSequence{}, *tree.getRootNode());
+
+    std::vector<StateChunk> chunks;
+    size_t keysSoFar = 0;
+    bool open = false;
+    for (const auto& slot : planner.slots()) {
+        if (!open) {
+            chunks.emplace_back();
+            chunks.back().firstSlot = slot.path;
+            open = true;
+        }
+        auto& chunk = chunks.back();
+        chunk.lastSlot = slot.path;
+        auto addKey = [&chunk, &getValue](ByteSequenceView key) {
+            chunk.kvs.emplace_back(ByteSequence{key.begin(), key.end()}, getValue(key));
+        };
+        if (slot.subtree != nullptr) {
+            auto path = pathOf(slot.path, *slot.subtree);
+            tree.forEachLeaf(*slot.subtree, path,
+                             [&addKey](ByteSequenceView key, const Node&) { addKey(key); });
+        } else {
+            auto key = slot.path;
+            if (!slot.isLeafSlot) {
+                key.insert(key.end(), slot.leaf->extension().begin(),
+                           slot.leaf->extension().end());
+            }
+            addKey(key);
+        }
+        // the upper nodes from the root down to the slot's, each serialized once per chunk
+        for (auto dbKey = slot.parent; chunk.proof.nodes.find(dbKey) == chunk.proof.nodes.end();
+             dbKey = planner.parentOf(dbKey)) {
+            const auto* node =
+                dbKey.empty() ? tree.getRootNode().get() : tree.getBranchNode(dbKey).get();
+            node->serialize(chunk.proof.nodes[dbKey]);
+            if (dbKey.empty()) {
+                break;
+            }
+        }
+        keysSoFar += slot.numKeys;
+        // chunk i closes once it holds its share of the keys, the last one takes the rest
+        if (chunks.size() < numChunks && keysSoFar * numChunks >= numKeys * chunks.size()) {
+            open = false;
+        }
+    }
+    return chunks;
+}
+
+bool verifyChunk(const unsigned char* rootHash, const StateChunk& chunk,
+                 BranchHashing branchHashing) {
+    std::vector<LeafHash> leafHashes;
+    return checkChunk(rootHash, chunk, branchHashing, leafHashes);
+}
+
+ChunkAssembler::ChunkAssembler(const unsigned char* rootHash, Tree::LeafHashing leafHashing,
+                               Tree::BranchHashing branchHashing)
+    : branchHashing_(branchHashing),
+      tree_(leafHashing, Tree::UnchangedWrites::apply, branchHashing) {
+    std::memcpy(rootHash_, rootHash, SHA256_DIGEST_LENGTH);
+}
+
+bool ChunkAssembler::add(const StateChunk& chunk) {
+    std::vector<LeafHash> leafHashes;
+    if (!checkChunk(rootHash_, chunk, branchHashing_, leafHashes)) {
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    if (finished_) {
+        return false;
+    }
+    // the added range that starts last at or before lastSlot is the only one that can overlap
+    auto itr = ranges_.upper_bound(chunk.lastSlot);
+    if (itr != ranges_.begin() && !LessThan{}(std::prev(itr)->second, chunk.firstSlot)) {
+        return false;
+    }
+    ranges_.emplace(chunk.firstSlot, chunk.lastSlot);
+    for (size_t k = 0; k < chunk.kvs.size(); ++k) {
+        tree_.insertLeafHash(chunk.kvs[k].first, leafHashes[k].data());
+    }
+    return true;
+}
+
+size_t ChunkAssembler::chunksAdded() const {
+    std::lock_guard lock(mutex_);
+    return ranges_.size();
+}
+
+std::optional<Tree> ChunkAssembler::finish(ThreadPool* pool) {
+    std::lock_guard lock(mutex_);
+    if (finished_) {
+        return std::nullopt;
+    }
+    if (pool != nullptr) {
+        tree_.calculateHash(*pool);
+    } else {
+        tree_.calculateHash();
+    }
+    if (!compareHashes(tree_.getRootNode()->hash(), rootHash_)) {
+        return std::nullopt;
+    }
+    finished_ = true;
+    return std::move(tree_);
+}
+
+};  // namespace merkle
@@ -0,0 +1,80 @@
+#include <functional>
+#include <map>
+#include <mutex>
+
+#include "detail/thread_pool.hpp"
+#include "proof.hpp"
+
+#pragma once
+
+namespace merkle {
+
+// A key range of a committed tree along with what it takes to check it against the root hash
+// alone, for state sync: a new replica fetches the chunks of a tree from any number of peers, in
+// any order, and checks each one as it arrives.
+//
+// Chunks are cut along subtrees. The upper branch nodes of the tree are split into their slots, the
+// leaf slot and the children, until no slot holds more than about size / numChunks keys, and each
+// chunk takes a run of consecutive slots. A slot is named by its path: the path of its branch node,
+// i.e. db key and extension, followed by the child byte, or alone for the leaf slot. Key order is
+// LessThan order, so slots sort like the keys below them.
+struct StateChunk {
+    // the first and last slot the chunk covers
+    ByteSequence firstSlot;
+    ByteSequence lastSlot;
+    // every key value below those slots, in key order
+    std::vector<std::pair<ByteSequence, ByteSequence>> kvs;
+    // the branch nodes the slots belong to, up to the root
+    Proof proof;
+
+    // slots and key values length prefixed, then the serialized proof
+    void serialize(ByteSequence& out) const;
+    // nullopt when in is truncated or has trailing bytes
+    static std::optional<StateChunk> deserialize(ByteSequenceView in);
+};
+
+// Splits the tree, which must be committed with calculateHash, into up to numChunks chunks of
+// about as many keys each. There are fewer when slots can't be split further, e.g. a tree of a
+// handful of keys. The tree holds leaf hashes only, getValue(key) gives the value of a key, e.g.
+// from the key value store the tree commits to.
+std::vector<StateChunk> splitIntoChunks(
+    const Tree& tree, size_t numChunks,
+    const std::function<ByteSequence(ByteSequenceView key)>& getValue);
+
+// Checks that chunk holds exactly the key values of the tree of rootHash below its slots: the
+// proof nodes chain up to rootHash, and every slot of theirs from firstSlot to lastSlot is matched
+// by the key values that start with its path, a leaf by its hash and a subtree by the hash of the
+// subtree the key values build. Extensions are not part of the hashes, like with verifyProof.
+// branchHashing is the one of the tree.
+bool verifyChunk(const unsigned char* rootHash, const StateChunk& chunk,
+                 BranchHashing branchHashing = BranchHashing::flat);
+
+// Rebuilds the tree of a root hash from its chunks. Chunks are added in any order and from any
+// number of threads, each is verified on the calling thread and its leaves then go into the tree
+// one chunk at a time. A chunk that fails can be fetched again and added later, the ones added so
+// far are kept.
+class ChunkAssembler {
+   public:
+    explicit ChunkAssembler(const unsigned char* rootHash,
+                            Tree::LeafHashing leafHashing = Tree::LeafHashing::eager,
+                            Tree::BranchHashing branchHashing = Tree::BranchHashing::flat);
+
+    // false when chunk does not verify, overlaps a chunk added before or the tree was handed over
+    bool add(const StateChunk& chunk);
+    size_t chunksAdded() const;
+    // Commits the tree and hands it over when it has the expected root hash, which is once all of
+    // the chunks were added. nullopt otherwise, more chunks can then still be added. Hands the
+    // tree over once, nullopt ever after.
+    std::optional<Tree> finish(ThreadPool* pool = nullptr);
+
+   private:
+    unsigned char rootHash_[SHA256_DIGEST_LENGTH];
+    BranchHashing branchHashing_;
+    mutable std::mutex mutex_;
+    Tree tree_;
+    bool finished_ = false;
+    // the slots of the chunks added, first to last
+    std::map<ByteSequence, ByteSequence, LessThan> ranges_;
+};
+
+};  // namespace merkle
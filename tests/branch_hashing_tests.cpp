@@ -0,0 +1,301 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <sstream>
+
+#include "../proof.hpp"
+#include "../sharded_tree.hpp"
+#include "../state_sync.hpp"
+#include "../tree_builder.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+using Hash = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+constexpr BranchHashing kInternalModes[] = {BranchHashing::binary, BranchHashing::radix16};
+
+// ChildrenTree as its comment defines it, from scratch.
+std::optional<Hash> referenceRoot(std::vector<std::optional<Hash>> level, size_t arity) {
+    while (level.size() > 1) {
+        std::vector<std::optional<Hash>> above;
+        for (size_t first = 0; first < level.size(); first += arity) {
+            ByteSequence toHash;
+            bool empty = true;
+            for (size_t j = first; j < first + arity; ++j) {
+                const auto* hash = level[j] ? level[j]->data() : BranchNode::kNullNodeHash;
+                toHash.insert(toHash.end(), hash, hash + SHA256_DIGEST_LENGTH);
+                empty = empty && !level[j];
+            }
+            auto& entry = above.emplace_back();
+            if (!empty) {
+                entry.emplace();
+                computeSHA256(toHash, entry->data());
+            }
+        }
+        level = std::move(above);
+    }
+    return level.front();
+}
+
+// A branch node hash as the BranchHashing comment defines it, from scratch.
+Hash referenceBranchHash(BranchHashing mode, const std::optional<Hash>& leafSlot,
+                         const std::vector<std::optional<Hash>>& children) {
+    ByteSequence toHash;
+    auto append = [&toHash](const std::optional<Hash>& hash) {
+        const auto* bytes = hash ? hash->data() : BranchNode::kNullNodeHash;
+        toHash.insert(toHash.end(), bytes, bytes + SHA256_DIGEST_LENGTH);
+    };
+    append(leafSlot);
+    if (mode == BranchHashing::flat) {
+        std::for_each(children.begin(), children.end(), append);
+    } else {
+        append(referenceRoot(children, ChildrenTree::arity(mode)));
+    }
+    Hash hash;
+    computeSHA256(toHash, hash.data());
+    return hash;
+}
+
+Hash leafHash(const ByteSequence& key, const ByteSequence& value) {
+    Hash hash;
+    HashOfLeaf::computeHash(key, value, hash.data());
+    return hash;
+}
+
+// the keys of the test vectors: a dense root, a node with both a leaf slot and children, and a
+// long extension
+KeyValues vectorKVs() {
+    KeyValues kvs;
+    for (int i = 0; i < 40; ++i) {
+        kvs[ByteSequence{static_cast<Byte>(i * 5)}] = ByteSequence{'v', static_cast<Byte>(i)};
+    }
+    kvs[ByteSequence{'a', 'b'}] = ByteSequence{'x'};
+    kvs[ByteSequence{'a', 'b', 'c', 'd', 'e', 'f'}] = ByteSequence{'y'};
+    kvs[ByteSequence{}] = ByteSequence{'z'};
+    return kvs;
+}
+
+}  // namespace
+
+TEST(BranchHashing, test_vectors) {
+    BranchNode::setNullNodeHash();
+    auto kvs = vectorKVs();
+    const std::pair<BranchHashing, std::string> vectors[] = {
+        {BranchHashing::flat, "756182ff41c6da22bab6561b716bcd0049e5dcd20e79fbcde837ce7914053d90"},
+        {BranchHashing::binary, "a08651150721dd65bc8ea9012a6eba901343fbfce57ed01c580a7f8835355ce7"},
+        {BranchHashing::radix16,
+         "f8a3a5b460aff3d237da295896d054fffb744ef5e8c0b67e3ea1f580d25003d2"},
+    };
+    for (const auto& [mode, hex] : vectors) {
+        // the node of "ab" with "abcdef" below it, under child 'a' of the root
+        std::vector<std::optional<Hash>> children(BranchNode::kBranchingFactor);
+        children['c'] = leafHash(ByteSequence{'a', 'b', 'c', 'd', 'e', 'f'}, ByteSequence{'y'});
+        auto abLeaf = leafHash(ByteSequence{'a', 'b'}, ByteSequence{'x'});
+        auto abHash = referenceBranchHash(mode, abLeaf, children);
+        children.assign(BranchNode::kBranchingFactor, std::nullopt);
+        children['a'] = abHash;
+        for (const auto& [key, value] : kvs) {
+            if (key.size() == 1) {
+                children[key[0]] = leafHash(key, value);
+            }
+        }
+        auto rootHash = referenceBranchHash(mode, leafHash(ByteSequence{}, ByteSequence{'z'}),
+                                            children);
+
+        auto tree = makeTree(kvs, mode);
+        ASSERT_EQ(Node::toHex(tree.getRootNode()->hash()), hex);
+        ASSERT_EQ(Node::toHex(rootHash.data()), hex);
+    }
+}
+
+TEST(BranchHashing, children_tree_updates) {
+    BranchNode::setNullNodeHash();
+    std::mt19937 gen(1);
+    std::vector<Hash> pool(64);
+    for (auto& hash : pool) {
+        for (auto& b : hash) {
+            b = static_cast<unsigned char>(gen());
+        }
+    }
+    for (auto mode : kInternalModes) {
+        ChildrenTree tree(mode);
+        std::vector<std::optional<Hash>> children(BranchNode::kBranchingFactor);
+        ASSERT_EQ(tree.update(BranchNode::ChildHashes{}), nullptr);
+        // from sparse to dense and back, a few children at a time
+        for (size_t round = 0; round < 200; ++round) {
+            auto fill = round < 100 ? 8 : 1;
+            for (size_t i = 0; i < 4; ++i) {
+                auto& child = children[gen() % children.size()];
+                if (gen() % 10 < static_cast<unsigned>(fill)) {
+                    child = pool[gen() % pool.size()];
+                } else {
+                    child.reset();
+                }
+            }
+            BranchNode::ChildHashes childHashes;
+            for (size_t i = 0; i < children.size(); ++i) {
+                childHashes[i] = children[i] ? children[i]->data() : nullptr;
+            }
+            const auto* root = tree.update(childHashes);
+            auto expected = referenceRoot(children, ChildrenTree::arity(mode));
+            ASSERT_EQ(root == nullptr, !expected.has_value());
+            if (root == nullptr) {
+                continue;
+            }
+            ASSERT_TRUE(compareHashes(root, expected->data()));
+            // every child folds back up to the root with its siblings
+            for (size_t i = 0; i < children.size(); i += 7) {
+                if (!children[i]) {
+                    continue;
+                }
+                std::vector<const unsigned char*> siblings;
+                tree.siblings(static_cast<Byte>(i), siblings);
+                ASSERT_EQ(siblings.size(), ChildrenTree::numSiblings(mode));
+                unsigned char folded[SHA256_DIGEST_LENGTH];
+                ASSERT_TRUE(compareHashes(ChildrenTree::foldPath(mode, static_cast<Byte>(i),
+                                                                 children[i]->data(), siblings,
+                                                                 folded),
+                                          root));
+            }
+        }
+    }
+}
+
+TEST(BranchHashing, every_way_to_build_agrees) {
+    auto kvs = randomKVs(1500, 2, {.maxLength = 5, .alphabet = 64});
+    std::map<BranchHashing, Hash> roots;
+    for (auto mode : {BranchHashing::flat, BranchHashing::binary, BranchHashing::radix16}) {
+        auto tree = makeTree(kvs, mode);
+        ASSERT_EQ(tree.branchHashing(), mode);
+        const auto* rootHash = tree.getRootNode()->hash();
+        std::copy_n(rootHash, SHA256_DIGEST_LENGTH, roots[mode].begin());
+
+        Tree deferred(Tree::LeafHashing::deferred, Tree::UnchangedWrites::apply, mode);
+        TreeBuilder builder(mode);
+        TreeBuilder::KeyValues pairs;
+        ShardedTree sharded(Tree::LeafHashing::eager, 2, mode);
+        for (const auto& [key, value] : kvs) {
+            deferred.insert(ByteSequenceView{key}, ByteSequenceView{value});
+            builder.add(key, value);
+            pairs.emplace_back(key, value);
+            sharded.insert(ByteSequenceView{key}, ByteSequenceView{value});
+        }
+        ThreadPool pool(2);
+        deferred.calculateHash(pool);
+        ASSERT_TRUE(compareHashes(deferred.getRootNode()->hash(), rootHash));
+        ASSERT_TRUE(compareHashes(builder.finish().getRootNode()->hash(), rootHash));
+        auto parallel = TreeBuilder::buildParallel(std::move(pairs), 2, mode);
+        ASSERT_TRUE(compareHashes(parallel.getRootNode()->hash(), rootHash));
+        ASSERT_TRUE(compareHashes(sharded.calculateHash(), rootHash));
+
+        std::stringstream snapshot;
+        ASSERT_TRUE(tree.exportSnapshot(snapshot));
+        auto imported = Tree::importSnapshot(snapshot);
+        ASSERT_TRUE(imported.has_value());
+        ASSERT_EQ(imported->branchHashing(), mode);
+        ASSERT_TRUE(compareHashes(imported->getRootNode()->hash(), rootHash));
+
+        // the nodes that keep their ChildrenTree, and the imported ones that have none yet, hash
+        // like a fresh build after writes
+        auto changed = kvs;
+        std::mt19937 gen(3);
+        for (size_t round = 0; round < 3; ++round) {
+            for (size_t i = 0; i < 50; ++i) {
+                ByteSequence key{static_cast<Byte>(gen() % 64), static_cast<Byte>(gen() % 64)};
+                ByteSequence value{static_cast<Byte>(gen())};
+                tree.insert(ByteSequenceView{key}, ByteSequenceView{value});
+                imported->insert(ByteSequenceView{key}, ByteSequenceView{value});
+                changed[key] = value;
+            }
+            tree.calculateHash();
+            imported->calculateHash();
+            auto rebuilt = makeTree(changed, mode);
+            ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), rebuilt.getRootNode()->hash()));
+            ASSERT_TRUE(
+                compareHashes(imported->getRootNode()->hash(), rebuilt.getRootNode()->hash()));
+        }
+    }
+    ASSERT_FALSE(
+        compareHashes(roots[BranchHashing::flat].data(), roots[BranchHashing::binary].data()));
+    ASSERT_FALSE(
+        compareHashes(roots[BranchHashing::binary].data(), roots[BranchHashing::radix16].data()));
+}
+
+TEST(BranchHashing, path_proofs) {
+    auto kvs = randomKVs(2000, 4, {.maxLength = 5, .alphabet = 256});
+    auto flatTree = makeTree(kvs, BranchHashing::flat);
+    for (auto mode : kInternalModes) {
+        auto tree = makeTree(kvs, mode);
+        const auto* rootHash = tree.getRootNode()->hash();
+        size_t pathBytes = 0;
+        size_t nodeBytes = 0;
+        for (const auto& [key, value] : kvs) {
+            auto proof = generatePathProof(tree, key);
+            ASSERT_TRUE(proof.has_value());
+            ASSERT_TRUE(verifyPathProof(rootHash, *proof, {key, value}, mode));
+            ByteSequence bytes;
+            proof->serialize(bytes);
+            ASSERT_EQ(bytes.size(), proof->byteSize());
+            auto copy = PathProof::deserialize(bytes, mode);
+            ASSERT_TRUE(copy.has_value());
+            ASSERT_TRUE(verifyPathProof(rootHash, *copy, {key, value}, mode));
+            pathBytes += bytes.size();
+            nodeBytes += generateProof(flatTree, key).byteSize();
+            // the node proofs of the tree still work given its branch hashing
+            KeyValueView kv{key, value};
+            auto nodeProof = generateProof(tree, key);
+            ASSERT_TRUE(verifyProof(rootHash, nodeProof, std::span{&kv, 1}, mode));
+            ASSERT_FALSE(verifyProof(rootHash, nodeProof, std::span{&kv, 1}));
+        }
+        // several times smaller on a tree with a dense upper level
+        ASSERT_LT(pathBytes * 3, nodeBytes);
+
+        const auto& [key, value] = *std::next(kvs.begin(), kvs.size() / 2);
+        auto proof = *generatePathProof(tree, key);
+        ASSERT_GE(proof.steps.size(), 2);
+        ASSERT_FALSE(verifyPathProof(rootHash, proof, {key, ByteSequence{'x'}}, mode));
+        auto otherMode =
+            mode == BranchHashing::binary ? BranchHashing::radix16 : BranchHashing::binary;
+        ASSERT_FALSE(verifyPathProof(rootHash, proof, {key, value}, otherMode));
+        auto tampered = proof;
+        tampered.steps.erase(tampered.steps.begin());
+        ASSERT_FALSE(verifyPathProof(rootHash, tampered, {key, value}, mode));
+        tampered = proof;
+        tampered.steps.back().position += 1;
+        ASSERT_FALSE(verifyPathProof(rootHash, tampered, {key, value}, mode));
+        tampered = proof;
+        auto& sibling = *std::find_if(tampered.steps.front().siblings.begin(),
+                                      tampered.steps.front().siblings.end(),
+                                      [](const auto& s) { return s.has_value(); });
+        (*sibling)[0] ^= 1;
+        ASSERT_FALSE(verifyPathProof(rootHash, tampered, {key, value}, mode));
+        sibling.reset();
+        ASSERT_FALSE(verifyPathProof(rootHash, tampered, {key, value}, mode));
+
+        ByteSequence bytes;
+        proof.serialize(bytes);
+        bytes.pop_back();
+        ASSERT_FALSE(PathProof::deserialize(bytes, mode).has_value());
+
+        auto absent = kvs.rbegin()->first;
+        absent.push_back(7);
+        ASSERT_FALSE(generatePathProof(tree, absent).has_value());
+
+        // state sync chunks check against the tree's branch hashing
+        auto chunks = splitIntoChunks(tree, 4, [&kvs](ByteSequenceView k) {
+            return kvs.at(ByteSequence{k.begin(), k.end()});
+        });
+        ASSERT_TRUE(verifyChunk(rootHash, chunks[1], mode));
+        ASSERT_FALSE(verifyChunk(rootHash, chunks[1]));
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
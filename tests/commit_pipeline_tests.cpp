@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "../commit_pipeline.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+// blocks of count random writes, keys over a small alphabet so that blocks overwrite each other
+std::vector<KeyValues> randomBlocks(size_t blocks, size_t count, uint32_t seed) {
+    constexpr KeyShape kShape{
+        .minLength = 1, .maxLength = 6, .alphabet = 4, .stride = 60, .valueSize = 1};
+    std::vector<KeyValues> result;
+    for (size_t b = 0; b < blocks; ++b) {
+        result.push_back(randomKVs(count, seed * 1000 + b, kShape));
+    }
+    return result;
+}
+
+}  // namespace
+
+TEST(CommitPipeline, roots_match_sequential_commits) {
+    auto blocks = randomBlocks(20, 300, 1);
+    std::vector<CommitPipeline::RootHash> expected;
+    {
+        Tree tree;
+        for (const auto& block : blocks) {
+            for (const auto& [key, value] : block) {
+                tree.insert(ByteSequence{key}, ByteSequence{value});
+            }
+            tree.calculateHash();
+            auto& root = expected.emplace_back();
+            std::memcpy(root.data(), tree.getRootNode()->hash(), SHA256_DIGEST_LENGTH);
+        }
+    }
+    for (size_t hashThreads : {1, 4}) {
+        Tree tree;
+        CommitPipeline pipeline(tree, hashThreads);
+        std::vector<std::shared_future<CommitPipeline::RootHash>> roots;
+        for (const auto& block : blocks) {
+            for (const auto& [key, value] : block) {
+                pipeline.insert(key, value);
+            }
+            roots.push_back(pipeline.commitBlock());
+        }
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            ASSERT_EQ(roots[i].get(), expected[i]);
+        }
+        pipeline.wait();
+        ASSERT_EQ(pipeline.blocksInFlight(), 0);
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), expected.back().data()));
+    }
+}
+
+TEST(CommitPipeline, find_sees_newest_write) {
+    Tree tree;
+    CommitPipeline pipeline(tree, 2);
+    const ByteSequence key{'k'};
+    auto expectValue = [&](const ByteSequence& value) {
+        auto lookup = pipeline.find(key);
+        ASSERT_TRUE(lookup.found);
+        HashOfLeaf leaf{key, value};
+        ASSERT_TRUE(compareHashes(lookup.leafHash, leaf.hash()));
+    };
+    ASSERT_FALSE(pipeline.find(key).found);
+    pipeline.insert(key, ByteSequence{'1'});
+    expectValue(ByteSequence{'1'});
+    // block 1 goes in flight, the open block and then the sealed one shadow the tree
+    auto blocks = randomBlocks(1, 2000, 2);
+    for (const auto& [k, v] : blocks.front()) {
+        pipeline.insert(k, v);
+    }
+    pipeline.commitBlock();
+    expectValue(ByteSequence{'1'});
+    pipeline.insert(key, ByteSequence{'2'});
+    expectValue(ByteSequence{'2'});
+    ASSERT_EQ(pipeline.openBlockSize(), 1);
+    auto root = pipeline.commitBlock();
+    expectValue(ByteSequence{'2'});
+    root.wait();
+    expectValue(ByteSequence{'2'});
+    ASSERT_GT(pipeline.find(key).nodesVisited, 0);
+    ASSERT_FALSE(pipeline.find(ByteSequence{'y'}).found);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
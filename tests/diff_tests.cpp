@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+#include "../diff.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+constexpr KeyShape kShape{.minLength = 1, .maxLength = 6, .alphabet = 4, .valueSize = 1};
+
+void insertAll(Tree& tree, const KeyValues& kvs) {
+    for (const auto& [key, value] : kvs) {
+        tree.insert(ByteSequence{key}, ByteSequence{value});
+    }
+}
+
+// Reference diff computed from the full leaf lists.
+std::vector<LeafDiff> fullDiff(const Tree& from, const Tree& to) {
+    std::map<ByteSequence, std::string, LessThan> fromLeaves;
+    std::map<ByteSequence, std::string, LessThan> toLeaves;
+    auto collect = [](auto& leaves) {
+        return [&leaves](ByteSequenceView key, const Node& leaf) {
+            leaves[ByteSequence{key.begin(), key.end()}] =
+                std::string(reinterpret_cast<const char*>(leaf.hash()), SHA256_DIGEST_LENGTH);
+        };
+    };
+    from.forEachLeaf(collect(fromLeaves));
+    to.forEachLeaf(collect(toLeaves));
+    std::map<ByteSequence, LeafDiff::Kind, LessThan> kinds;
+    for (const auto& [key, hash] : fromLeaves) {
+        auto itr = toLeaves.find(key);
+        if (itr == toLeaves.end()) {
+            kinds[key] = LeafDiff::removed;
+        } else if (itr->second != hash) {
+            kinds[key] = LeafDiff::changed;
+        }
+    }
+    for (const auto& [key, hash] : toLeaves) {
+        if (fromLeaves.find(key) == fromLeaves.end()) {
+            kinds[key] = LeafDiff::added;
+        }
+    }
+    std::vector<LeafDiff> out;
+    for (const auto& [key, kind] : kinds) {
+        out.push_back(LeafDiff{kind, key});
+    }
+    return out;
+}
+
+void assertSameDiff(const std::vector<LeafDiff>& actual, const std::vector<LeafDiff>& expected) {
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+        ASSERT_EQ(actual[i].kind, expected[i].kind);
+        ASSERT_EQ(actual[i].key, expected[i].key);
+    }
+}
+
+}  // namespace
+
+TEST(Diff, identical_trees_are_pruned_at_root) {
+    auto kvs = randomKVs(200, 1, kShape);
+    Tree a;
+    Tree b;
+    insertAll(a, kvs);
+    insertAll(b, kvs);
+    a.calculateHash();
+    b.calculateHash();
+    auto result = diff(a, b);
+    ASSERT_TRUE(result.leaves.empty());
+    ASSERT_EQ(result.nodesVisited, 2);
+}
+
+TEST(Diff, empty_tree) {
+    auto kvs = randomKVs(50, 2, kShape);
+    Tree empty;
+    Tree full;
+    insertAll(full, kvs);
+    empty.calculateHash();
+    full.calculateHash();
+    auto added = diff(empty, full);
+    ASSERT_EQ(added.leaves.size(), kvs.size());
+    auto itr = kvs.begin();
+    for (const auto& leaf : added.leaves) {
+        ASSERT_EQ(leaf.kind, LeafDiff::added);
+        ASSERT_EQ(leaf.key, itr->first);
+        ++itr;
+    }
+    assertSameDiff(diff(full, empty).leaves, fullDiff(full, empty));
+}
+
+TEST(Diff, single_change_reads_only_its_path) {
+    std::mt19937 gen(3);
+    std::map<ByteSequence, ByteSequence, LessThan> kvs;
+    for (int i = 0; i < 2000; ++i) {
+        ByteSequence key;
+        for (int j = 0; j < 8; ++j) {
+            key.push_back(static_cast<Byte>(gen()));
+        }
+        kvs[key] = ByteSequence{'v'};
+    }
+    Tree a;
+    Tree b;
+    insertAll(a, kvs);
+    insertAll(b, kvs);
+    auto changedKey = std::next(kvs.begin(), 1000)->first;
+    b.insert(ByteSequence{changedKey}, ByteSequence{'w'});
+    a.calculateHash();
+    b.calculateHash();
+    auto result = diff(a, b);
+    ASSERT_EQ(result.leaves.size(), 1);
+    ASSERT_EQ(result.leaves[0].kind, LeafDiff::changed);
+    ASSERT_EQ(result.leaves[0].key, changedKey);
+    ASSERT_LT(result.nodesVisited, 10);
+}
+
+TEST(Diff, matches_full_comparison) {
+    for (uint32_t seed = 10; seed < 30; ++seed) {
+        auto fromKVs = randomKVs(150, seed, kShape);
+        auto toKVs = fromKVs;
+        std::mt19937 gen(seed);
+        // drop, change and add keys, which changes extensions and splits branch nodes
+        for (auto itr = toKVs.begin(); itr != toKVs.end();) {
+            auto action = gen() % 8;
+            if (action == 0) {
+                itr = toKVs.erase(itr);
+                continue;
+            }
+            if (action == 1) {
+                itr->second.push_back('x');
+            }
+            ++itr;
+        }
+        for (const auto& [key, value] : randomKVs(40, seed + 1000, kShape)) {
+            toKVs[key] = value;
+        }
+        Tree from;
+        Tree to;
+        insertAll(from, fromKVs);
+        insertAll(to, toKVs);
+        from.calculateHash();
+        to.calculateHash();
+        assertSameDiff(diff(from, to).leaves, fullDiff(from, to));
+        assertSameDiff(diff(to, from).leaves, fullDiff(to, from));
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
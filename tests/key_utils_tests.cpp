@@ -236,6 +236,70 @@ TEST(ByteSequence, less_than) {
     }
 }
 
+TEST(ByteSequence, find_mismatch) {
+    // Cover the vector widths, their tails and a mismatch at every position.
+    for (size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 64, 100, 128, 129}) {
+        ByteSequence lhs(size);
+        for (size_t i = 0; i < size; ++i) {
+            lhs[i] = static_cast<Byte>(i * 7);
+        }
+        ASSERT_EQ(findMismatch(lhs.data(), lhs.data(), size), size);
+        for (size_t pos = 0; pos < size; ++pos) {
+            auto rhs = lhs;
+            rhs[pos] ^= 0x80;
+            ASSERT_EQ(findMismatch(lhs.data(), rhs.data(), size), pos);
+            // a later difference must not hide the first one
+            rhs[size - 1] ^= 0x01;
+            ASSERT_EQ(findMismatch(lhs.data(), rhs.data(), size), pos);
+        }
+    }
+}
+
+TEST(ByteSequence, less_than_and_compare_bytes_long_keys) {
+    ByteSequence key(96, 'a');
+    for (size_t pos = 0; pos < key.size(); ++pos) {
+        auto bigger = key;
+        bigger[pos] = 'b';
+        ASSERT_TRUE(LessThan{}(key, bigger));
+        ASSERT_FALSE(LessThan{}(bigger, key));
+        ASSERT_FALSE(CompareBytes{}(key, bigger));
+        auto prefix = ByteSequenceView{key.data(), pos};
+        ASSERT_TRUE(LessThan{}(prefix, key));
+        ASSERT_FALSE(CompareBytes{}(prefix, key));
+    }
+    auto copy = key;
+    ASSERT_TRUE(CompareBytes{}(ByteSequenceToView(copy), key));
+    ASSERT_FALSE(LessThan{}(copy, key));
+
+    ByteSequence longExt(70, 'x');
+    ByteSequence other = longExt;
+    other[40] = 'y';
+    auto [res, num] = ExtensionView{longExt}.compareTo(ByteSequenceToView(other));
+    ASSERT_EQ(res, ExtensionView::diverge);
+    ASSERT_EQ(num, 40);
+}
+
+TEST(KeyUtils, sip_hash_reference_vectors) {
+    // the vectors of the SipHash paper and its reference implementation: key 00..0f, message
+    // 00..len-1, the 64 bit output read little endian
+    SipKey key{0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL};
+    ByteSequence message;
+    ASSERT_EQ(sipHash(message, key), 0x726fdb47dd0e0e31ULL);
+    auto [low, high] = sipHash128(message, key);
+    ASSERT_EQ(low, 0xe6a825ba047f81a3ULL);
+    ASSERT_EQ(high, 0x930255c71472f66dULL);
+    for (Byte b = 0; b < 15; ++b) {
+        message.push_back(b);
+    }
+    ASSERT_EQ(sipHash(message, key), 0xa129ca6149be45e5ULL);
+
+    // every key bit counts
+    auto other = key;
+    other.k1 ^= 1ULL << 63;
+    ASSERT_NE(sipHash(message, other), sipHash(message, key));
+    ASSERT_NE(sipHash128(message, other), sipHash128(message, key));
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,395 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include "../compactor.hpp"
+#include "../node_reader.hpp"
+#include "../pruner.hpp"
+
+using namespace merkle;
+
+namespace {
+
+class NodeLogTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        path_ = std::filesystem::temp_directory_path() /
+                ("kvmerkle_" + std::string(::testing::UnitTest::GetInstance()
+                                               ->current_test_info()
+                                               ->name()) +
+                 "_" + std::to_string(::getpid()) + ".log");
+        std::filesystem::remove(path_);
+    }
+    void TearDown() override { std::filesystem::remove(path_); }
+
+    std::filesystem::path path_;
+};
+
+ByteSequence randomKey(std::mt19937& gen) {
+    ByteSequence key(1 + gen() % 6);
+    for (auto& b : key) {
+        // small alphabet to get deep paths
+        b = static_cast<Byte>(gen() % 4);
+    }
+    return key;
+}
+
+using RootHash = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+
+// Loads every node of version from the log and checks that the hashes chain up to rootHash.
+// Returns the number of nodes.
+size_t checkVersion(const NodeLog& log, uint64_t version, const unsigned char* rootHash) {
+    size_t nodes = 0;
+    // db key and the hash the parent holds for it
+    std::vector<std::pair<ByteSequence, RootHash>> pending(1);
+    std::memcpy(pending.back().second.data(), rootHash, SHA256_DIGEST_LENGTH);
+    while (!pending.empty()) {
+        auto [dbKey, expectedHash] = std::move(pending.back());
+        pending.pop_back();
+        auto node = log.load(dbKey, version);
+        EXPECT_NE(node, nullptr);
+        if (node == nullptr) {
+            return nodes;
+        }
+        ++nodes;
+        node->computeHash();
+        EXPECT_TRUE(compareHashes(node->hash(), expectedHash.data()));
+        dbKey.insert(dbKey.end(), node->extension().begin(), node->extension().end());
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            if (node->getTypeOfChild(byte) != Node::Type::HashOfBranch) {
+                continue;
+            }
+            auto& [childKey, childHash] = pending.emplace_back(dbKey, RootHash{});
+            childKey.push_back(byte);
+            std::memcpy(childHash.data(), node->getChildAt(byte)->hash(), SHA256_DIGEST_LENGTH);
+        }
+    }
+    return nodes;
+}
+
+RootHash rootHashOf(const Tree& tree) {
+    RootHash hash;
+    std::memcpy(hash.data(), tree.getRootNode()->hash(), SHA256_DIGEST_LENGTH);
+    return hash;
+}
+
+// Commits versions 1..count, each updating a few keys of tree.
+std::vector<RootHash> commitVersions(Tree& tree, NodeLog& log, uint64_t first, uint64_t count,
+                                     std::mt19937& gen) {
+    std::vector<RootHash> roots;
+    for (uint64_t version = first; version < first + count; ++version) {
+        for (int i = 0; i < 5; ++i) {
+            tree.insert(randomKey(gen), ByteSequence{static_cast<Byte>(version)});
+        }
+        tree.calculateHash();
+        log.commit(tree, version);
+        roots.push_back(rootHashOf(tree));
+    }
+    return roots;
+}
+
+}  // namespace
+
+TEST_F(NodeLogTest, commit_and_load) {
+    std::mt19937 gen(1);
+    Tree tree;
+    for (int i = 0; i < 200; ++i) {
+        tree.insert(randomKey(gen), ByteSequence{'v'});
+    }
+    tree.calculateHash();
+    auto firstRoot = rootHashOf(tree);
+    {
+        NodeLog log(path_.string());
+        ASSERT_EQ(log.commit(tree, 1), tree.dbSize() + 1);
+        ASSERT_EQ(checkVersion(log, 1, firstRoot.data()), tree.dbSize() + 1);
+        // nothing changed, only the root is appended
+        ASSERT_EQ(log.commit(tree, 2), 1);
+        // only the updated path is appended
+        tree.insert(ByteSequence{0, 1, 2, 3}, ByteSequence{'w'});
+        tree.calculateHash();
+        ASSERT_EQ(log.commit(tree, 3), tree.numDirtynodes_ + 1);
+        ASSERT_EQ(checkVersion(log, 3, tree.getRootNode()->hash()), tree.dbSize() + 1);
+        ASSERT_EQ(checkVersion(log, 2, firstRoot.data()), checkVersion(log, 1, firstRoot.data()));
+        ASSERT_EQ(log.versions(), (std::vector<uint64_t>{1, 2, 3}));
+        ASSERT_EQ(log.deadBytes(), 0);
+        ASSERT_EQ(log.fileBytes(), std::filesystem::file_size(path_));
+    }
+    // a torn record at the end is dropped when the index is rebuilt
+    auto size = std::filesystem::file_size(path_);
+    {
+        std::ofstream out(path_, std::ios::binary | std::ios::app);
+        out.write("torn", 4);
+    }
+    {
+        NodeLog log(path_.string(), NodeLog::Durability::buffered);
+        ASSERT_EQ(log.fileBytes(), size);
+        ASSERT_EQ(std::filesystem::file_size(path_), size);
+        ASSERT_EQ(log.versions(), (std::vector<uint64_t>{1, 2, 3}));
+        ASSERT_EQ(checkVersion(log, 3, tree.getRootNode()->hash()), tree.dbSize() + 1);
+        ASSERT_EQ(checkVersion(log, 1, firstRoot.data()), checkVersion(log, 2, firstRoot.data()));
+    }
+    // so is a torn header whose sizes are garbage, their sum wraps around
+    for (auto [keySize, nodeSize] : {std::pair{~uint64_t{0}, uint64_t{64}},
+                                     std::pair{uint64_t{4}, ~uint64_t{0} - 16}}) {
+        {
+            uint64_t header[3] = {4, keySize, nodeSize};
+            std::ofstream out(path_, std::ios::binary | std::ios::app);
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+            out.write("torn", 4);
+        }
+        NodeLog log(path_.string());
+        ASSERT_EQ(log.fileBytes(), size);
+        ASSERT_EQ(std::filesystem::file_size(path_), size);
+        ASSERT_EQ(log.versions(), (std::vector<uint64_t>{1, 2, 3}));
+    }
+}
+
+TEST_F(NodeLogTest, prune_keeps_retained_roots) {
+    std::mt19937 gen(2);
+    Tree tree;
+    NodeLog log(path_.string());
+    auto roots = commitVersions(tree, log, 1, 20, gen);
+    auto fileBytes = log.fileBytes();
+
+    Pruner pruner(log, 3);
+    size_t steps = 0;
+    while (!pruner.step(1)) {
+        ++steps;
+    }
+    ASSERT_GT(steps, 1);
+    const auto& result = pruner.result();
+    ASSERT_EQ(result.versionsDropped, 17);
+    ASSERT_GT(result.recordsReclaimed, 0);
+    ASSERT_EQ(log.versions(), (std::vector<uint64_t>{18, 19, 20}));
+    ASSERT_EQ(log.fileBytes(), fileBytes);
+    ASSERT_EQ(log.deadBytes(), result.bytesReclaimed);
+    for (uint64_t version = 18; version <= 20; ++version) {
+        checkVersion(log, version, roots[version - 1].data());
+    }
+    // the old roots are gone
+    ASSERT_FALSE(log.locate(ByteSequence{}, 17).has_value());
+
+    // a second pass has nothing left to reclaim
+    Pruner again(log, 3);
+    again.run();
+    ASSERT_EQ(again.result().recordsReclaimed, 0);
+    ASSERT_EQ(again.result().recordsMarked, result.recordsMarked);
+
+    // committing goes on from the pruned log
+    auto more = commitVersions(tree, log, 21, 2, gen);
+    checkVersion(log, 22, more.back().data());
+}
+
+TEST_F(NodeLogTest, prune_is_throttled) {
+    std::mt19937 gen(3);
+    Tree tree;
+    NodeLog log(path_.string());
+    commitVersions(tree, log, 1, 5, gen);
+    // the marking reads about 20KB
+    constexpr uint64_t kRate = 200 * 1024;
+    auto start = std::chrono::steady_clock::now();
+    Pruner pruner(log, 2, kRate);
+    pruner.run();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    ASSERT_GE(elapsed.count() * 1.05, static_cast<double>(pruner.result().bytesRead) / kRate);
+}
+
+TEST_F(NodeLogTest, background_pruner) {
+    std::mt19937 gen(4);
+    Tree tree;
+    NodeLog log(path_.string());
+    std::vector<RootHash> roots;
+    {
+        BackgroundPruner background(log, 4);
+        for (uint64_t version = 1; version <= 40; ++version) {
+            auto root = commitVersions(tree, log, version, 1, gen);
+            roots.push_back(root.back());
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        while (background.passes() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    // whatever the pruner dropped, the newest versions are intact
+    Pruner pruner(log, 4);
+    pruner.run();
+    ASSERT_EQ(log.versions(), (std::vector<uint64_t>{37, 38, 39, 40}));
+    for (uint64_t version = 37; version <= 40; ++version) {
+        checkVersion(log, version, roots[version - 1].data());
+    }
+}
+
+TEST_F(NodeLogTest, compact_after_prune) {
+    std::mt19937 gen(5);
+    Tree tree;
+    std::vector<RootHash> roots;
+    {
+        NodeLog log(path_.string());
+        roots = commitVersions(tree, log, 1, 20, gen);
+        Pruner(log, 3).run();
+        auto deadBytes = log.deadBytes();
+        ASSERT_GT(deadBytes, 0);
+        auto liveBytes = log.liveBytes();
+        auto generation = log.generation();
+
+        auto result = compact(log);
+        ASSERT_EQ(result.bytesReclaimed(), deadBytes);
+        ASSERT_EQ(result.bytesAfter, liveBytes);
+        ASSERT_EQ(result.recordsCarried, 0);
+        ASSERT_EQ(log.deadBytes(), 0);
+        ASSERT_EQ(log.fileBytes(), liveBytes);
+        ASSERT_EQ(std::filesystem::file_size(path_), liveBytes);
+        ASSERT_EQ(log.generation(), generation + 1);
+        ASSERT_EQ(log.versions(), (std::vector<uint64_t>{18, 19, 20}));
+        for (uint64_t version = 18; version <= 20; ++version) {
+            checkVersion(log, version, roots[version - 1].data());
+        }
+
+        // the records are laid out in db key order, which is depth first
+        auto previous = log.locate(ByteSequence{}, 20);
+        ASSERT_TRUE(previous.has_value());
+        tree.forEachBranchNode([&](ByteSequenceView dbKey, const BranchNode&) {
+            auto location = log.locate(dbKey, 20);
+            ASSERT_TRUE(location.has_value());
+            ASSERT_GT(location->offset, previous->offset);
+            previous = location;
+        });
+
+        // committing goes on in the compacted file
+        auto more = commitVersions(tree, log, 21, 2, gen);
+        roots.insert(roots.end(), more.begin(), more.end());
+        checkVersion(log, 22, roots.back().data());
+        ASSERT_EQ(log.fileBytes(), std::filesystem::file_size(path_));
+    }
+    NodeLog log(path_.string());
+    ASSERT_EQ(log.versions(), (std::vector<uint64_t>{18, 19, 20, 21, 22}));
+    ASSERT_EQ(log.deadBytes(), 0);
+    for (uint64_t version = 18; version <= 22; ++version) {
+        checkVersion(log, version, roots[version - 1].data());
+    }
+}
+
+TEST_F(NodeLogTest, compact_online) {
+    std::mt19937 gen(6);
+    Tree tree;
+    NodeLog log(path_.string());
+    auto roots = commitVersions(tree, log, 1, 30, gen);
+    Pruner(log, 10).run();
+
+    // a pass that started before the compaction restarts on the moved records
+    Pruner pruner(log, 5);
+    ASSERT_FALSE(pruner.step(1));
+    // commits and reads go on while the copy is throttled
+    std::atomic<bool> compacted{false};
+    CompactionResult result;
+    std::thread compactor([&] {
+        result = compact(log, 256 * 1024);
+        compacted.store(true);
+    });
+    uint64_t version = 31;
+    while (!compacted.load()) {
+        auto root = commitVersions(tree, log, version, 1, gen);
+        roots.push_back(root.back());
+        checkVersion(log, version - 3, roots[version - 4].data());
+        ++version;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    compactor.join();
+    ASSERT_GT(result.bytesReclaimed(), 0);
+    ASSERT_EQ(log.deadBytes(), 0);
+    ASSERT_EQ(log.fileBytes(), std::filesystem::file_size(path_));
+
+    pruner.run();
+    auto newest = version - 1;
+    ASSERT_EQ(log.versions().front(), newest - 4);
+    ASSERT_EQ(log.deadBytes(), pruner.result().bytesReclaimed);
+    for (auto retained = newest - 4; retained <= newest; ++retained) {
+        checkVersion(log, retained, roots[retained - 1].data());
+    }
+}
+
+TEST_F(NodeLogTest, compact_while_pruning) {
+    std::mt19937 gen(8);
+    Tree tree;
+    std::vector<RootHash> roots;
+    {
+        NodeLog log(path_.string());
+        roots = commitVersions(tree, log, 1, 20, gen);
+        // the copy takes about half a second, the pruner sweeps in the meantime
+        CompactionResult result;
+        std::thread compactor([&] { result = compact(log, log.fileBytes() * 2); });
+        auto compactPath = path_.string() + ".compact";
+        while (!std::filesystem::exists(compactPath)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        Pruner(log, 3).run();
+        compactor.join();
+
+        ASSERT_EQ(log.versions(), (std::vector<uint64_t>{18, 19, 20}));
+        ASSERT_GT(result.bytesReclaimed(), 0);
+        ASSERT_LT(result.bytesReclaimed(), result.bytesBefore);
+        ASSERT_EQ(result.bytesAfter, log.fileBytes());
+        ASSERT_EQ(log.deadBytes(), 0);
+        ASSERT_EQ(std::filesystem::file_size(path_), log.liveBytes());
+    }
+    // the pruned versions don't come back
+    NodeLog log(path_.string());
+    ASSERT_EQ(log.versions(), (std::vector<uint64_t>{18, 19, 20}));
+    ASSERT_EQ(log.deadBytes(), 0);
+    for (uint64_t version = 18; version <= 20; ++version) {
+        checkVersion(log, version, roots[version - 1].data());
+    }
+}
+
+TEST_F(NodeLogTest, multi_proof_from_log) {
+    std::mt19937 gen(7);
+    Tree tree;
+    NodeLog log(path_.string());
+    commitVersions(tree, log, 1, 10, gen);
+    std::vector<ByteSequence> keys;
+    for (int i = 0; i < 50; ++i) {
+        keys.push_back(randomKey(gen));
+    }
+    auto expected = generateMultiProof(tree, keys);
+
+    AsyncNodeReader reader(log, 4);
+    LogProofStats stats;
+    auto proof = generateMultiProof(reader, 10, keys, &stats);
+    ASSERT_EQ(proof.nodes, expected.nodes);
+    ASSERT_EQ(stats.nodesRead, proof.nodes.size());
+    // one round per level, far fewer than one read per node
+    ASSERT_LT(stats.rounds, stats.nodesRead);
+    ASSERT_LE(stats.rounds, 8);
+
+    // older versions stay provable as the log grows
+    commitVersions(tree, log, 11, 3, gen);
+    ASSERT_EQ(generateMultiProof(reader, 10, keys).nodes, expected.nodes);
+    ASSERT_EQ(generateMultiProof(reader, 13, keys).nodes, generateMultiProof(tree, keys).nodes);
+
+    auto root = reader.read(ByteSequence{}, 13).get();
+    ASSERT_TRUE(root.has_value());
+    ASSERT_TRUE(compareHashes(root->data() + 1, tree.getRootNode()->hash()));
+    ASSERT_FALSE(reader.read(ByteSequence{}, 0).get().has_value());
+    ASSERT_TRUE(generateMultiProof(reader, 0, keys).nodes.empty());
+
+    // a corrupt extension size in the root record of version 10 fails its proof and its load
+    auto location = log.locate(ByteSequence{}, 10);
+    ASSERT_TRUE(location.has_value());
+    {
+        std::fstream file(path_, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(static_cast<std::streamoff>(location->nodeOffset() + 1 + SHA256_DIGEST_LENGTH));
+        const char hugeSize[Node::kSizeField] = {-1, -1, -1, -1, -1, -1, -1, 0x7f};
+        file.write(hugeSize, sizeof(hugeSize));
+    }
+    ASSERT_TRUE(generateMultiProof(reader, 10, keys).nodes.empty());
+    ASSERT_EQ(log.load(ByteSequence{}, 10), nullptr);
+    ASSERT_EQ(generateMultiProof(reader, 13, keys).nodes, generateMultiProof(tree, keys).nodes);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+#include "../proof.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+constexpr KeyShape kShape{.minLength = 1, .maxLength = 8, .alphabet = 4, .valueSize = 1};
+
+bool verify(const Tree& tree, const Proof& proof, const ByteSequence& key,
+            const ByteSequence& value) {
+    KeyValueView kv{key, value};
+    return verifyProof(tree.getRootNode()->hash(), proof, std::span{&kv, 1});
+}
+
+}  // namespace
+
+TEST(Proof, single_key) {
+    std::vector<ByteSequence> keys{{'b', 'd', 'f', 'k', 'l', 'm'},
+                                   {'b', 'd', 'f', 'k', 'l'},
+                                   {'b', 'd', 'f', 'g', 'q'},
+                                   {'c'},
+                                   {}};
+    Tree tree;
+    for (const auto& key : keys) {
+        tree.insert(ByteSequence{key}, ByteSequence{'v'});
+    }
+    tree.calculateHash();
+    for (const auto& key : keys) {
+        auto proof = generateProof(tree, key);
+        ASSERT_TRUE(proof.nodes.contains(ByteSequence{}));
+        ASSERT_TRUE(verify(tree, proof, key, {'v'}));
+        ASSERT_FALSE(verify(tree, proof, key, {'w'}));
+    }
+    // root -> b -> bdfk
+    ASSERT_EQ(generateProof(tree, ByteSequence{'b', 'd', 'f', 'k', 'l', 'm'}).nodes.size(), 3);
+    ASSERT_EQ(generateProof(tree, ByteSequence{'c'}).nodes.size(), 1);
+    // absent keys are not members
+    auto proof = generateProof(tree, ByteSequence{'b', 'd', 'x'});
+    ASSERT_FALSE(verify(tree, proof, {'b', 'd', 'x'}, {'v'}));
+    // another key's proof does not reach the leaf
+    ASSERT_FALSE(verify(tree, generateProof(tree, ByteSequence{'c'}),
+                        {'b', 'd', 'f', 'k', 'l', 'm'}, {'v'}));
+    // a different root
+    Tree other;
+    other.insert(ByteSequence{'c'}, ByteSequence{'v'});
+    other.calculateHash();
+    ASSERT_FALSE(verify(other, generateProof(tree, ByteSequence{'c'}), {'c'}, {'v'}));
+}
+
+TEST(Proof, multi_proof_shares_nodes) {
+    auto kvs = randomKVs(500, 5, kShape);
+    auto tree = makeTree(kvs);
+    std::vector<ByteSequence> keys;
+    std::vector<KeyValueView> members;
+    size_t separateNodes = 0;
+    size_t separateBytes = 0;
+    size_t i = 0;
+    for (const auto& [key, value] : kvs) {
+        if (i++ % 10 != 0) {
+            continue;
+        }
+        keys.push_back(key);
+        members.emplace_back(key, value);
+        auto single = generateProof(tree, key);
+        separateNodes += single.nodes.size();
+        separateBytes += single.byteSize();
+    }
+    auto proof = generateMultiProof(tree, keys);
+    ASSERT_LT(proof.nodes.size(), separateNodes);
+    ASSERT_LT(proof.byteSize(), separateBytes);
+    ASSERT_TRUE(verifyProof(tree.getRootNode()->hash(), proof, members));
+
+    // round trip through bytes
+    ByteSequence bytes;
+    proof.serialize(bytes);
+    ASSERT_EQ(bytes.size(), proof.byteSize());
+    auto fromBytes = Proof::deserialize(bytes);
+    ASSERT_TRUE(fromBytes.has_value());
+    ASSERT_EQ(fromBytes->nodes, proof.nodes);
+    ASSERT_TRUE(verifyProof(tree.getRootNode()->hash(), *fromBytes, members));
+    bytes.pop_back();
+    ASSERT_FALSE(Proof::deserialize(bytes).has_value());
+
+    // one wrong value fails the whole batch
+    ByteSequence wrong{static_cast<Byte>(members.back().second[0] + 1)};
+    members.back().second = wrong;
+    ASSERT_FALSE(verifyProof(tree.getRootNode()->hash(), proof, members));
+}
+
+TEST(Proof, tampered_proofs_are_rejected) {
+    auto kvs = randomKVs(200, 11, kShape);
+    auto tree = makeTree(kvs);
+    const auto& [key, value] = *std::next(kvs.begin(), 100);
+    auto proof = generateProof(tree, key);
+    ASSERT_GT(proof.nodes.size(), 2);
+    ASSERT_TRUE(verify(tree, proof, key, value));
+
+    // a child hash changed in any of the nodes breaks the chain up to the root
+    for (const auto& [dbKey, bytes] : proof.nodes) {
+        auto tampered = proof;
+        auto& tamperedBytes = tampered.nodes[dbKey];
+        // past type, hash, extension size and extension: the leaf slot and children
+        auto childrenPos = 1 + SHA256_DIGEST_LENGTH + Node::kSizeField +
+                           BranchNode::deserialize(bytes)->extension().size();
+        for (size_t pos = childrenPos; pos < tamperedBytes.size(); ++pos) {
+            if (tamperedBytes[pos] == Node::Type::HashOfLeaf ||
+                tamperedBytes[pos] == Node::Type::HashOfBranch) {
+                // the first byte of the child's hash
+                tamperedBytes[pos + 1] ^= 1;
+                break;
+            }
+        }
+        ASSERT_FALSE(verify(tree, tampered, key, value));
+    }
+
+    // a missing node on the path
+    auto missing = proof;
+    missing.nodes.erase(std::prev(missing.nodes.end()));
+    ASSERT_FALSE(verify(tree, missing, key, value));
+
+    // a node that does not chain to the root
+    auto extra = proof;
+    ByteSequence rootBytes = proof.nodes.at(ByteSequence{});
+    extra.nodes.emplace(ByteSequence{9, 9, 9}, rootBytes);
+    ASSERT_FALSE(verify(tree, extra, key, value));
+
+    // malformed node bytes: truncated anywhere, an extension size past the end, an unknown child
+    // type, trailing bytes
+    // the root has no extension, its leaf slot follows the extension size
+    constexpr size_t kLeafSlotPos = 1 + SHA256_DIGEST_LENGTH + Node::kSizeField;
+    for (size_t size : {size_t{0}, size_t{1}, kLeafSlotPos, rootBytes.size() - 1}) {
+        auto malformed = proof;
+        malformed.nodes[ByteSequence{}].resize(size);
+        ASSERT_FALSE(verify(tree, malformed, key, value));
+    }
+    auto malformed = proof;
+    malformed.nodes[ByteSequence{}][kLeafSlotPos - 1] = 0x7f;
+    ASSERT_FALSE(verify(tree, malformed, key, value));
+    malformed = proof;
+    malformed.nodes[ByteSequence{}][kLeafSlotPos] = 0x42;
+    ASSERT_FALSE(verify(tree, malformed, key, value));
+    malformed = proof;
+    malformed.nodes[ByteSequence{}].push_back(Node::NullNode);
+    ASSERT_FALSE(verify(tree, malformed, key, value));
+    std::vector<ProofItem> items{ProofItem{key, value, &malformed}};
+    ASSERT_FALSE(verifyProofs(tree.getRootNode()->hash(), items, 2).allVerified());
+}
+
+TEST(Proof, batch_verification) {
+    auto kvs = randomKVs(400, 17, kShape);
+    auto tree = makeTree(kvs);
+    std::vector<Proof> proofs;
+    proofs.reserve(kvs.size());
+    for (const auto& [key, value] : kvs) {
+        proofs.push_back(generateProof(tree, key));
+    }
+    std::vector<ProofItem> items;
+    size_t i = 0;
+    for (const auto& [key, value] : kvs) {
+        items.push_back(ProofItem{key, value, &proofs[i++]});
+    }
+    // a wrong value and a proof of another key
+    ByteSequence wrong{static_cast<Byte>(std::next(kvs.begin(), 3)->second[0] + 1)};
+    items[3].value = wrong;
+    items[7].proof = &proofs.back();
+    size_t totalNodes = 0;
+    for (const auto& item : items) {
+        totalNodes += item.proof->nodes.size();
+    }
+
+    for (size_t numThreads : {1, 4}) {
+        auto result = verifyProofs(tree.getRootNode()->hash(), items, numThreads);
+        ASSERT_EQ(result.verified.size(), items.size());
+        ASSERT_FALSE(result.allVerified());
+        for (size_t j = 0; j < items.size(); ++j) {
+            ASSERT_EQ(result.verified[j], j != 3 && j != 7) << j;
+        }
+        // the upper levels are shared, every distinct node is hashed about once
+        ASSERT_EQ(result.nodesHashed + result.nodesReused, totalNodes);
+        ASSERT_LT(result.nodesHashed, totalNodes / 2);
+    }
+    items[3].value = std::next(kvs.begin(), 3)->second;
+    items[7].proof = &proofs[7];
+    ASSERT_TRUE(verifyProofs(tree.getRootNode()->hash(), items, 2).allVerified());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <thread>
+
+#include "../proof.hpp"
+#include "../sharded_tree.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+// keys spread over six shards, 255 among them, with deep paths below
+constexpr KeyShape kShape{
+    .minLength = 0, .maxLength = 5, .alphabet = 6, .stride = 51, .valueSize = 1};
+
+void expectSameRoot(ShardedTree& sharded, Tree& tree) {
+    tree.calculateHash();
+    ASSERT_TRUE(compareHashes(sharded.calculateHash(), tree.getRootNode()->hash()));
+}
+
+}  // namespace
+
+TEST(ShardedTree, root_hash_matches_tree) {
+    for (auto leafHashing : {Tree::LeafHashing::eager, Tree::LeafHashing::deferred}) {
+        ShardedTree sharded(leafHashing, 2);
+        Tree tree;
+        expectSameRoot(sharded, tree);
+        // a single leaf under the root, then the empty key in the root's leaf slot
+        sharded.insert(ByteSequence{7, 1}, ByteSequence{'v'});
+        tree.insert(ByteSequence{7, 1}, ByteSequence{'v'});
+        expectSameRoot(sharded, tree);
+        sharded.insert(ByteSequence{}, ByteSequence{'e'});
+        tree.insert(ByteSequence{}, ByteSequence{'e'});
+        expectSameRoot(sharded, tree);
+
+        auto kvs = randomKVs(2000, 1, kShape);
+        size_t inserted = 0;
+        for (const auto& [key, value] : kvs) {
+            sharded.insert(ByteSequenceView{key}, ByteSequenceView{value});
+            tree.insert(ByteSequence{key}, ByteSequence{value});
+            if (inserted++ % 500 == 0) {
+                expectSameRoot(sharded, tree);
+            }
+        }
+        expectSameRoot(sharded, tree);
+        // the last child of the root, 255, is a shard like any other
+        for (const auto& key : {ByteSequence{255}, ByteSequence{255, 0, 3}, ByteSequence{255, 7}}) {
+            sharded.insert(ByteSequenceView{key}, ByteSequenceView{key});
+            tree.insert(ByteSequence{key}, ByteSequence{key});
+        }
+        expectSameRoot(sharded, tree);
+        sharded.insert(ByteSequence{255, 7}, ByteSequence{'w'});
+        tree.insert(ByteSequence{255, 7}, ByteSequence{'w'});
+        expectSameRoot(sharded, tree);
+        ASSERT_EQ(sharded.lastCommitShards(), 1);
+        ASSERT_TRUE(sharded.find(ByteSequence{255, 0, 3}).found);
+        // only the shards that were written are committed
+        sharded.insert(ByteSequence{31, 2}, ByteSequence{'w'});
+        tree.insert(ByteSequence{31, 2}, ByteSequence{'w'});
+        expectSameRoot(sharded, tree);
+        ASSERT_EQ(sharded.lastCommitShards(), 1);
+        sharded.calculateHash();
+        ASSERT_EQ(sharded.lastCommitShards(), 0);
+        ASSERT_TRUE(compareHashes(sharded.rootHash(), tree.getRootNode()->hash()));
+
+        for (const auto& [key, value] : kvs) {
+            auto lookup = sharded.find(key);
+            auto expected = tree.find(key);
+            ASSERT_EQ(lookup.found, expected.found);
+            ASSERT_TRUE(compareHashes(lookup.leafHash, expected.leafHash));
+        }
+        ASSERT_FALSE(sharded.find(ByteSequence{255, 1}).found);
+    }
+}
+
+TEST(ShardedTree, shard_proofs) {
+    ShardedTree sharded(Tree::LeafHashing::eager, 1);
+    Tree tree;
+    auto kvs = randomKVs(500, 2, kShape);
+    for (const auto& [key, value] : kvs) {
+        sharded.insert(ByteSequenceView{key}, ByteSequenceView{value});
+        tree.insert(ByteSequence{key}, ByteSequence{value});
+    }
+    expectSameRoot(sharded, tree);
+    // below the root a shard has the same nodes as the unsharded tree
+    // the last key, in shard 255
+    auto key = std::prev(kvs.end())->first;
+    key.push_back(0);
+    auto shardProof = generateProof(sharded.shard(key[0]), key);
+    auto proof = generateProof(tree, key);
+    shardProof.nodes.erase(ByteSequence{});
+    proof.nodes.erase(ByteSequence{});
+    ASSERT_EQ(shardProof.nodes, proof.nodes);
+}
+
+TEST(ShardedTree, parallel_writers) {
+    constexpr size_t kWriters = 4;
+    ShardedTree sharded(Tree::LeafHashing::eager, kWriters);
+    Tree tree;
+    auto kvs = randomKVs(4000, 4, kShape);
+    for (const auto& [key, value] : kvs) {
+        tree.insert(ByteSequence{key}, ByteSequence{value});
+    }
+    // each writer takes the keys of some shards, and a committer runs meanwhile
+    std::atomic<bool> writing{true};
+    std::thread committer([&] {
+        while (writing.load()) {
+            sharded.calculateHash();
+        }
+    });
+    std::vector<std::thread> writers;
+    for (size_t w = 0; w < kWriters; ++w) {
+        writers.emplace_back([&, w] {
+            for (const auto& [key, value] : kvs) {
+                if ((key.empty() ? 0 : key[0]) % kWriters == w) {
+                    sharded.insert(ByteSequenceView{key}, ByteSequenceView{value});
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    writing.store(false);
+    committer.join();
+    expectSameRoot(sharded, tree);
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include "../tree.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+constexpr KeyShape kShape{.minLength = 0, .maxLength = 7, .alphabet = 4, .valueSize = 1};
+
+std::string exportToString(const Tree& tree) {
+    std::ostringstream out;
+    EXPECT_TRUE(tree.exportSnapshot(out));
+    return out.str();
+}
+
+std::optional<Tree> importFromString(const std::string& snapshot, ThreadPool* pool = nullptr) {
+    std::istringstream in(snapshot);
+    return Tree::importSnapshot(in, Tree::LeafHashing::eager, pool);
+}
+
+// Same root and the same serialized branch nodes under the same db keys.
+void expectSameTree(const Tree& expected, const Tree& actual) {
+    ASSERT_TRUE(compareHashes(expected.getRootNode()->hash(), actual.getRootNode()->hash()));
+    ASSERT_EQ(expected.dbSize(), actual.dbSize());
+    expected.forEachBranchNode([&actual](ByteSequenceView dbKey, const BranchNode& node) {
+        const auto& other = actual.getBranchNode(dbKey);
+        ASSERT_NE(other, nullptr);
+        ByteSequence bytes;
+        ByteSequence otherBytes;
+        node.serialize(bytes);
+        other->serialize(otherBytes);
+        ASSERT_EQ(bytes, otherBytes);
+    });
+}
+
+// The snapshot with its trailing checksum recomputed, as a forger would.
+std::string rechecksum(std::string snapshot) {
+    auto body = snapshot.size() - SHA256_DIGEST_LENGTH;
+    computeSHA256(std::string_view{snapshot.data(), body},
+                  reinterpret_cast<unsigned char*>(snapshot.data() + body));
+    return snapshot;
+}
+
+}  // namespace
+
+TEST(Snapshot, round_trip) {
+    Tree empty;
+    empty.calculateHash();
+    auto emptyCopy = importFromString(exportToString(empty));
+    ASSERT_TRUE(emptyCopy.has_value());
+    expectSameTree(empty, *emptyCopy);
+
+    Tree tree;
+    auto kvs = randomKVs(3000, 1, kShape);
+    insertAndCommit(tree, kvs);
+    auto snapshot = exportToString(tree);
+    ThreadPool pool(4);
+    for (auto* verifyPool : {static_cast<ThreadPool*>(nullptr), &pool}) {
+        auto copy = importFromString(snapshot, verifyPool);
+        ASSERT_TRUE(copy.has_value());
+        expectSameTree(tree, *copy);
+        for (const auto& [key, value] : kvs) {
+            auto found = copy->find(key);
+            ASSERT_TRUE(found.found);
+            ASSERT_TRUE(compareHashes(found.leafHash, tree.find(key).leafHash));
+        }
+        // the copy takes further inserts like the original
+        copy->insert(ByteSequence{9, 9}, ByteSequence{'v'});
+        copy->calculateHash();
+        tree.insert(ByteSequence{9, 9}, ByteSequence{'v'});
+        tree.calculateHash();
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), copy->getRootNode()->hash()));
+        snapshot = exportToString(tree);
+    }
+}
+
+TEST(Snapshot, refuses_uncommitted_tree) {
+    std::ostringstream out;
+    ASSERT_FALSE(Tree{}.exportSnapshot(out));
+    // a key in an empty child slot of the root dirties the root alone
+    auto tree = makeTree(randomKVs(100, 3, kShape));
+    tree.insert(ByteSequence{9, 9}, ByteSequence{'v'});
+    ASSERT_FALSE(tree.exportSnapshot(out));
+    ASSERT_TRUE(out.str().empty());
+    tree.calculateHash();
+    ASSERT_TRUE(tree.exportSnapshot(out));
+    auto copy = importFromString(out.str());
+    ASSERT_TRUE(copy.has_value());
+    expectSameTree(tree, *copy);
+}
+
+TEST(Snapshot, file_round_trip) {
+    auto path = std::filesystem::temp_directory_path() /
+                ("kvmerkle_snapshot_" + std::to_string(::getpid()) + ".snap");
+    Tree tree(Tree::LeafHashing::deferred);
+    insertAndCommit(tree, randomKVs(2000, 2, kShape));
+    {
+        std::ofstream out(path, std::ios::binary);
+        ASSERT_TRUE(tree.exportSnapshot(out));
+        ASSERT_TRUE(out.good());
+    }
+    std::ifstream in(path, std::ios::binary);
+    ThreadPool pool(2);
+    auto copy = Tree::importSnapshot(in, Tree::LeafHashing::deferred, &pool);
+    std::filesystem::remove(path);
+    ASSERT_TRUE(copy.has_value());
+    ASSERT_EQ(copy->leafHashing(), Tree::LeafHashing::deferred);
+    expectSameTree(tree, *copy);
+}
+
+TEST(Snapshot, rejects_corruption) {
+    Tree tree;
+    insertAndCommit(tree, randomKVs(500, 3, kShape));
+    auto snapshot = exportToString(tree);
+    ThreadPool pool(2);
+    ASSERT_TRUE(importFromString(snapshot, &pool).has_value());
+
+    // any flipped byte, caught by the checksum if nothing else
+    std::mt19937 gen(3);
+    for (size_t i = 0; i < 50; ++i) {
+        auto corrupt = snapshot;
+        corrupt[gen() % corrupt.size()] ^= static_cast<char>(1 + gen() % 255);
+        ASSERT_FALSE(importFromString(corrupt, &pool).has_value());
+    }
+    for (size_t size : {size_t{0}, size_t{20}, snapshot.size() / 2, snapshot.size() - 1}) {
+        ASSERT_FALSE(importFromString(snapshot.substr(0, size), &pool).has_value());
+    }
+
+    // forged with a valid checksum: another root hash in the header
+    auto forged = snapshot;
+    forged[sizeof(uint64_t)] ^= 1;
+    ASSERT_FALSE(importFromString(rechecksum(forged), &pool).has_value());
+
+    // the root's leaf hash changed, the root's own hash no longer matches its children
+    std::string needle(reinterpret_cast<const char*>(tree.find(ByteSequence{}).leafHash),
+                       SHA256_DIGEST_LENGTH);
+    ASSERT_TRUE(tree.find(ByteSequence{}).found);
+    forged = snapshot;
+    auto leafPos = forged.find(needle);
+    ASSERT_NE(leafPos, std::string::npos);
+    forged[leafPos] ^= 1;
+    for (auto* verifyPool : {static_cast<ThreadPool*>(nullptr), &pool}) {
+        ASSERT_FALSE(importFromString(rechecksum(forged), verifyPool).has_value());
+    }
+
+    // nothing is read past the checksum
+    std::istringstream in(snapshot + "tail");
+    ASSERT_TRUE(Tree::importSnapshot(in).has_value());
+    std::string tail;
+    in >> tail;
+    ASSERT_EQ(tail, "tail");
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
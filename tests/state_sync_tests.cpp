@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <thread>
+
+#include "../state_sync.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+// the empty key now and then
+constexpr KeyShape kShape{.minLength = 0, .maxLength = 6, .alphabet = 5};
+
+std::vector<StateChunk> split(const Tree& tree, const KeyValues& kvs, size_t numChunks) {
+    return splitIntoChunks(tree, numChunks, [&kvs](ByteSequenceView key) {
+        return kvs.at(ByteSequence{key.begin(), key.end()});
+    });
+}
+
+}  // namespace
+
+TEST(StateSync, split_covers_every_key) {
+    auto kvs = randomKVs(3000, 1, kShape);
+    auto tree = makeTree(kvs);
+    const auto* rootHash = tree.getRootNode()->hash();
+    for (size_t numChunks : {1, 2, 7, 32, 100000}) {
+        auto chunks = split(tree, kvs, numChunks);
+        ASSERT_LE(chunks.size(), numChunks);
+        ASSERT_GT(chunks.size(), 0);
+        KeyValues seen;
+        for (const auto& chunk : chunks) {
+            ASSERT_TRUE(verifyChunk(rootHash, chunk));
+            for (const auto& [key, value] : chunk.kvs) {
+                ASSERT_TRUE(seen.emplace(key, value).second);
+            }
+            // roughly even, a slot is only kept whole when it fits a chunk's share
+            if (numChunks > 1 && numChunks < kvs.size()) {
+                ASSERT_LE(chunk.kvs.size(), 2 * (kvs.size() / numChunks + 1));
+            }
+        }
+        ASSERT_EQ(seen, kvs);
+        // consecutive chunks cover consecutive key ranges
+        for (size_t i = 1; i < chunks.size(); ++i) {
+            ASSERT_TRUE(LessThan{}(chunks[i - 1].lastSlot, chunks[i].firstSlot));
+            ASSERT_TRUE(LessThan{}(chunks[i - 1].kvs.back().first, chunks[i].kvs.front().first));
+        }
+    }
+    ASSERT_EQ(split(tree, kvs, 32).size(), 32);
+
+    auto chunk = split(tree, kvs, 5)[2];
+    ByteSequence bytes;
+    chunk.serialize(bytes);
+    auto copy = StateChunk::deserialize(bytes);
+    ASSERT_TRUE(copy.has_value());
+    ASSERT_EQ(copy->kvs, chunk.kvs);
+    ASSERT_EQ(copy->proof.nodes, chunk.proof.nodes);
+    ASSERT_TRUE(verifyChunk(rootHash, *copy));
+    bytes.pop_back();
+    ASSERT_FALSE(StateChunk::deserialize(bytes).has_value());
+
+    Tree empty;
+    empty.calculateHash();
+    ASSERT_TRUE(split(empty, {}, 4).empty());
+}
+
+TEST(StateSync, rejects_tampered_chunks) {
+    auto kvs = randomKVs(2000, 2, kShape);
+    auto tree = makeTree(kvs);
+    const auto* rootHash = tree.getRootNode()->hash();
+    auto chunks = split(tree, kvs, 8);
+    ASSERT_EQ(chunks.size(), 8);
+    const auto& chunk = chunks[3];
+    ASSERT_TRUE(verifyChunk(rootHash, chunk));
+
+    auto tampered = chunk;
+    tampered.kvs[tampered.kvs.size() / 2].second.push_back('x');
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    // a key left out, or one made up
+    tampered = chunk;
+    tampered.kvs.erase(tampered.kvs.begin() + tampered.kvs.size() / 2);
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    tampered = chunk;
+    auto madeUp = tampered.kvs.front().first;
+    madeUp.push_back(9);
+    tampered.kvs.insert(tampered.kvs.begin() + 1, {madeUp, ByteSequence{'v'}});
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    // a range claimed beyond the key values, and the next chunk's key values under this range
+    tampered = chunk;
+    tampered.lastSlot = chunks[4].lastSlot;
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    tampered.kvs = chunks[4].kvs;
+    tampered.firstSlot = chunk.firstSlot;
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    // the proof of another chunk, or of another root
+    tampered = chunk;
+    tampered.proof = chunks[0].proof;
+    if (tampered.proof.nodes != chunk.proof.nodes) {
+        ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    }
+    tampered.proof.nodes.clear();
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    // proof nodes that are not well formed, cut short or with a byte too many
+    for (auto cut : {size_t{1}, size_t{40}}) {
+        tampered = chunk;
+        auto& rootBytes = tampered.proof.nodes.at(ByteSequence{});
+        rootBytes.resize(rootBytes.size() - cut);
+        ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    }
+    tampered = chunk;
+    tampered.proof.nodes.begin()->second.push_back(0);
+    ASSERT_FALSE(verifyChunk(rootHash, tampered));
+    auto otherKVs = kvs;
+    otherKVs.begin()->second.push_back('x');
+    ASSERT_FALSE(verifyChunk(makeTree(otherKVs).getRootNode()->hash(), chunk));
+}
+
+TEST(StateSync, assemble_in_parallel) {
+    auto kvs = randomKVs(4000, 3, kShape);
+    auto tree = makeTree(kvs);
+    auto chunks = split(tree, kvs, 24);
+    std::shuffle(chunks.begin(), chunks.end(), std::mt19937(3));
+
+    ChunkAssembler assembler(tree.getRootNode()->hash());
+    // one chunk held back, the sync is resumed with it afterwards
+    constexpr size_t kWorkers = 4;
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < kWorkers; ++w) {
+        workers.emplace_back([&, w] {
+            for (size_t i = w; i + 1 < chunks.size(); i += kWorkers) {
+                EXPECT_TRUE(assembler.add(chunks[i]));
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    ASSERT_EQ(assembler.chunksAdded(), chunks.size() - 1);
+    ASSERT_FALSE(assembler.finish().has_value());
+    // a chunk added twice overlaps itself
+    ASSERT_FALSE(assembler.add(chunks.front()));
+    ASSERT_TRUE(assembler.add(chunks.back()));
+    ThreadPool pool(2);
+    auto synced = assembler.finish(&pool);
+    ASSERT_TRUE(synced.has_value());
+    ASSERT_TRUE(compareHashes(synced->getRootNode()->hash(), tree.getRootNode()->hash()));
+    ASSERT_EQ(synced->dbSize(), tree.dbSize());
+    for (const auto& [key, value] : kvs) {
+        ASSERT_TRUE(compareHashes(synced->find(key).leafHash, tree.find(key).leafHash));
+    }
+    // the tree was handed over
+    ASSERT_FALSE(assembler.finish().has_value());
+    ASSERT_FALSE(assembler.add(chunks.back()));
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,58 @@
+#include <map>
+#include <random>
+
+#include "../tree.hpp"
+
+#pragma once
+
+namespace merkle::test {
+
+using KeyValues = std::map<ByteSequence, ByteSequence, LessThan>;
+
+// The keys randomKVs draws. A small alphabet gives shared prefixes, keys that are prefixes of
+// other keys and deep paths, a minLength of 0 the empty key now and then.
+struct KeyShape {
+    int minLength = 0;
+    int maxLength = 6;
+    int alphabet = 4;
+    // the bytes are 0, stride, 2 * stride and so on, e.g. to spread keys over the root's children
+    int stride = 1;
+    size_t valueSize = 2;
+};
+
+// count distinct keys of shape with random values, the same ones for the same seed
+inline KeyValues randomKVs(size_t count, uint32_t seed, const KeyShape& shape = {}) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> lengthDist(shape.minLength, shape.maxLength);
+    std::uniform_int_distribution<int> byteDist(0, shape.alphabet - 1);
+    KeyValues kvs;
+    while (kvs.size() < count) {
+        ByteSequence key;
+        for (int i = lengthDist(gen); i > 0; --i) {
+            key.push_back(static_cast<Byte>(byteDist(gen) * shape.stride));
+        }
+        ByteSequence value(shape.valueSize);
+        for (auto& b : value) {
+            b = static_cast<Byte>(gen());
+        }
+        kvs[key] = std::move(value);
+    }
+    return kvs;
+}
+
+// Inserts kvs into tree and commits it.
+inline void insertAndCommit(Tree& tree, const KeyValues& kvs) {
+    for (const auto& [key, value] : kvs) {
+        tree.insert(ByteSequence{key}, ByteSequence{value});
+    }
+    tree.calculateHash();
+}
+
+// A committed tree of kvs.
+inline Tree makeTree(const KeyValues& kvs, BranchHashing branchHashing = BranchHashing::flat) {
+    Tree tree(branchHashing);
+    insertAndCommit(tree, kvs);
+    return tree;
+}
+
+}  // namespace merkle::test
@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+
+#include "../tree_builder.hpp"
+#include "test_utils.hpp"
+
+using namespace merkle;
+using namespace merkle::test;
+
+namespace {
+
+void assertSameTree(const Tree& built, const Tree& inserted) {
+    ASSERT_TRUE(compareHashes(built.getRootNode()->hash(), inserted.getRootNode()->hash()));
+    ASSERT_EQ(built.dbSize(), inserted.dbSize());
+    {
+        ByteSequence builtRoot;
+        ByteSequence insertedRoot;
+        built.getRootNode()->serialize(builtRoot);
+        inserted.getRootNode()->serialize(insertedRoot);
+        ASSERT_EQ(builtRoot, insertedRoot);
+    }
+    inserted.forEachBranchNode([&built](ByteSequenceView key, const BranchNode& node) {
+        const auto& builtNode = built.getBranchNode(key);
+        ASSERT_NE(builtNode, nullptr);
+        ByteSequence builtSer;
+        ByteSequence insertedSer;
+        builtNode->serialize(builtSer);
+        node.serialize(insertedSer);
+        ASSERT_EQ(builtSer, insertedSer);
+    });
+}
+
+}  // namespace
+
+TEST(TreeBuilder, empty) {
+    TreeBuilder builder;
+    auto built = builder.finish();
+    Tree inserted;
+    inserted.calculateHash();
+    assertSameTree(built, inserted);
+}
+
+TEST(TreeBuilder, matches_inserts) {
+    for (uint32_t seed = 0; seed < 20; ++seed) {
+        // a small alphabet yields keys that are prefixes of each other and deep paths
+        auto kvs =
+            randomKVs(300, seed, {.maxLength = 8, .alphabet = seed % 2 == 0 ? 3 : 256});
+        TreeBuilder builder;
+        for (const auto& [key, value] : kvs) {
+            builder.add(key, value);
+        }
+        ASSERT_EQ(builder.size(), kvs.size());
+        auto built = builder.finish();
+        Tree inserted;
+        // insert in an order unrelated to the key order
+        std::vector<std::pair<ByteSequence, ByteSequence>> shuffled(kvs.begin(), kvs.end());
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(seed));
+        for (auto& [key, value] : shuffled) {
+            inserted.insert(std::move(key), std::move(value));
+        }
+        inserted.calculateHash();
+        assertSameTree(built, inserted);
+        for (const auto& [key, value] : kvs) {
+            ASSERT_TRUE(built.find(key).found);
+        }
+    }
+}
+
+TEST(TreeBuilder, repeated_key_keeps_last_value) {
+    TreeBuilder builder;
+    builder.add(ByteSequence{'a'}, ByteSequence{'1'});
+    builder.add(ByteSequence{'a', 'b'}, ByteSequence{'1'});
+    builder.add(ByteSequence{'a', 'b'}, ByteSequence{'2'});
+    builder.add(ByteSequence{'b'}, ByteSequence{'1'});
+    ASSERT_EQ(builder.size(), 3);
+    auto built = builder.finish();
+    Tree inserted;
+    inserted.insert(ByteSequence{'a'}, ByteSequence{'1'});
+    inserted.insert(ByteSequence{'a', 'b'}, ByteSequence{'2'});
+    inserted.insert(ByteSequence{'b'}, ByteSequence{'1'});
+    inserted.calculateHash();
+    assertSameTree(built, inserted);
+}
+
+TEST(TreeBuilder, rejects_unsorted_input) {
+    TreeBuilder builder;
+    ASSERT_TRUE(builder.add(ByteSequence{'a'}, ByteSequence{'1'}));
+    ASSERT_TRUE(builder.add(ByteSequence{'b', 'c'}, ByteSequence{'1'}));
+    // a smaller key, a prefix of the last key and the empty key
+    ASSERT_FALSE(builder.add(ByteSequence{'a', 'z'}, ByteSequence{'2'}));
+    ASSERT_FALSE(builder.add(ByteSequence{'b'}, ByteSequence{'2'}));
+    ASSERT_FALSE(builder.add(ByteSequence{}, ByteSequence{'2'}));
+    ASSERT_TRUE(builder.add(ByteSequence{'b', 'd'}, ByteSequence{'1'}));
+    ASSERT_EQ(builder.size(), 3);
+
+    // the rejected pairs are left out of the tree
+    Tree inserted;
+    for (const auto& key : {ByteSequence{'a'}, ByteSequence{'b', 'c'}, ByteSequence{'b', 'd'}}) {
+        inserted.insert(ByteSequence{key}, ByteSequence{'1'});
+    }
+    inserted.calculateHash();
+    assertSameTree(builder.finish(), inserted);
+}
+
+TEST(TreeBuilder, build_parallel_matches_inserts) {
+    for (uint32_t seed = 0; seed < 6; ++seed) {
+        auto kvs =
+            randomKVs(2000, seed, {.maxLength = 10, .alphabet = seed % 2 == 0 ? 4 : 256});
+        // unsorted input with repeated keys, the last occurrence must win
+        TreeBuilder::KeyValues dump(kvs.begin(), kvs.end());
+        std::shuffle(dump.begin(), dump.end(), std::mt19937(seed));
+        for (size_t i = 0; i < 200; ++i) {
+            auto repeated = dump[i];
+            repeated.second.push_back('r');
+            kvs[repeated.first] = repeated.second;
+            dump.push_back(std::move(repeated));
+        }
+        Tree inserted;
+        for (const auto& [key, value] : dump) {
+            inserted.insert(ByteSequence{key}, ByteSequence{value});
+        }
+        inserted.calculateHash();
+        auto built = TreeBuilder::buildParallel(std::move(dump), 1 + seed % 4);
+        assertSameTree(built, inserted);
+    }
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
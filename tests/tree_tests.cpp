@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <random>
+#include <thread>
 
 #include "../tree.hpp"
 
@@ -397,6 +398,10 @@ TEST(Tree, new_key_diverges) {
         auto eq = std::ranges::equal(ext.begin(), ext.end(), expectedExtension.begin(),
                                      expectedExtension.end());
         ASSERT_TRUE(eq);
+        // the HashOfBranch at the root follows the split extension
+        auto hobExt = tree.getRootNode()->getChildAt('b')->extension();
+        ASSERT_TRUE(std::ranges::equal(hobExt.begin(), hobExt.end(), expectedExtension.begin(),
+                                       expectedExtension.end()));
         {
             auto& node = branchNode->getChildAt('k');
             ASSERT_EQ(node->getType(), merkle::Node::HashOfBranch);
@@ -532,6 +537,7 @@ TEST(Tree, calculate_hash_many_nodes) {
     tree.calculateHash();
     tree.printTree();
     ASSERT_EQ(tree.numDirtynodes_, tree.dbSize());
+#ifndef KVMERKLE_COMPACT_DB_KEYS
     // iterate over db_ backward, for each key, take the last byte
     // it should be the hashOfBranch Byte in the preceding node. validate that the hob hash matches
     // the current node hash.
@@ -550,6 +556,394 @@ TEST(Tree, calculate_hash_many_nodes) {
         b = it->first.back();
         prvNode = it->second.get();
     }
+#endif
+}
+
+TEST(Tree, find) {
+    Tree tree;
+    {
+        auto lookup = tree.find(ByteSequence{'a'});
+        ASSERT_FALSE(lookup.found);
+        ASSERT_EQ(lookup.nodesVisited, 1);
+    }
+    std::vector<ByteSequence> keys{{'b', 'd', 'f', 'k', 'l', 'm'},
+                                   {'b', 'd', 'f', 'k', 'l'},
+                                   {'b', 'd', 'f', 'g', 'q'},
+                                   {'c'},
+                                   {},
+                                   {255, 255, 255},
+                                   {255}};
+    for (const auto& key : keys) {
+        tree.insert(ByteSequence{key}, ByteSequence{'v'});
+    }
+    tree.calculateHash();
+    for (const auto& key : keys) {
+        auto lookup = tree.find(key);
+        ASSERT_TRUE(lookup.found);
+        auto hashOfLeaf = HashOfLeaf{key, {'v'}};
+        ASSERT_TRUE(compareHashes(lookup.leafHash, hashOfLeaf.hash()));
+    }
+    // root -> b branch -> bdfk branch -> leaf at m
+    ASSERT_EQ(tree.find(ByteSequence{'b', 'd', 'f', 'k', 'l', 'm'}).nodesVisited, 4);
+    // leaf directly under the root
+    ASSERT_EQ(tree.find(ByteSequence{'c'}).nodesVisited, 2);
+    // prefixes, extensions of existing keys and diverging keys are absent
+    for (const auto& key : std::vector<ByteSequence>{{'b'},
+                                                     {'b', 'd', 'f', 'k'},
+                                                     {'b', 'd', 'f', 'k', 'l', 'm', 'n'},
+                                                     {'b', 'd', 'x'},
+                                                     {'c', 'c'},
+                                                     {255, 255}}) {
+        ASSERT_FALSE(tree.find(key).found);
+    }
+    // updates are visible
+    tree.insert(ByteSequence{'c'}, ByteSequence{'w'});
+    auto updated = HashOfLeaf{{'c'}, {'w'}};
+    ASSERT_TRUE(compareHashes(tree.find(ByteSequence{'c'}).leafHash, updated.hash()));
+}
+
+TEST(Tree, find_batch) {
+    for (auto leafHashing : {Tree::LeafHashing::eager, Tree::LeafHashing::deferred}) {
+        Tree tree(leafHashing);
+        std::mt19937 gen(11);
+        std::vector<ByteSequence> keys;
+        for (int i = 0; i < 500; ++i) {
+            // short keys over a small alphabet give prefixes, extensions and misses of every kind
+            ByteSequence key(gen() % 6);
+            for (auto& b : key) {
+                b = static_cast<Byte>(gen() % 3);
+            }
+            if (i % 2 == 0) {
+                tree.insert(ByteSequence{key}, ByteSequence{static_cast<Byte>(i)});
+            }
+            keys.push_back(std::move(key));
+        }
+        std::vector<ByteSequenceView> views(keys.begin(), keys.end());
+        for (size_t group : {1, 3, 16, 1000}) {
+            std::vector<Tree::LookupResult> results(views.size());
+            tree.findBatch(views, results, group);
+            for (size_t i = 0; i < views.size(); ++i) {
+                auto expected = tree.find(views[i]);
+                ASSERT_EQ(results[i].found, expected.found);
+                ASSERT_EQ(results[i].nodesVisited, expected.nodesVisited);
+                ASSERT_TRUE(compareHashes(results[i].leafHash, expected.leafHash));
+            }
+        }
+        std::vector<Tree::LookupResult> none;
+        tree.findBatch({}, none);
+    }
+}
+
+TEST(Tree, stats) {
+    Tree tree;
+    for (const auto& key : std::vector<ByteSequence>{{'b', 'd', 'f', 'k', 'l', 'm'},
+                                                     {'b', 'd', 'f', 'k', 'l'},
+                                                     {'b', 'd', 'f', 'g', 'q'},
+                                                     {'c'}}) {
+        tree.insert(ByteSequence{key}, ByteSequence{'v'});
+    }
+    tree.calculateHash();
+    auto stats = tree.collectStats();
+    // root -> b (extension df) -> bdfk (extension l)
+    ASSERT_EQ(stats.branchNodes, 3);
+    ASSERT_EQ(stats.branchNodes, tree.dbSize() + 1);
+    ASSERT_EQ(stats.leaves, 4);
+    ASSERT_EQ(stats.branchNodesByDepth, (std::map<size_t, size_t>{{0, 1}, {1, 1}, {2, 1}}));
+    ASSERT_EQ(stats.leavesByDepth, (std::map<size_t, size_t>{{0, 1}, {1, 1}, {2, 2}}));
+    ASSERT_EQ(stats.fanOut, (std::map<size_t, size_t>{{2, 3}}));
+    ASSERT_EQ(stats.branchExtensionLengths, (std::map<size_t, size_t>{{0, 1}, {1, 1}, {2, 1}}));
+    ASSERT_EQ(stats.leafExtensionLengths, (std::map<size_t, size_t>{{0, 3}, {1, 1}}));
+    ASSERT_GT(stats.bytesPerBranchNode(), BranchNode::kBranchingFactor);
+
+    if constexpr (kStatsEnabled) {
+        const auto& counters = tree.counters();
+        ASSERT_EQ(counters.inserts.load(), 4);
+        ASSERT_EQ(counters.leafHashes.load(), 4);
+        ASSERT_GT(counters.insertDbLookups.load(), 0);
+        ASSERT_EQ(counters.commits.load(), 1);
+        ASSERT_EQ(counters.lastCommitBranchHashes.load(), 3);
+        ASSERT_GE(counters.commitNanos.load(), counters.commitHashNanos.load());
+        // only the path to the update is hashed again
+        tree.insert(ByteSequence{'c'}, ByteSequence{'w'});
+        tree.calculateHash();
+        ASSERT_EQ(counters.lastCommitBranchHashes.load(), 1);
+        ASSERT_EQ(counters.branchHashes.load(), 4);
+    }
+}
+
+TEST(Tree, deferred_leaf_hashing) {
+    std::vector<ByteSequence> keys{{'b', 'd', 'f', 'k', 'l', 'm'},
+                                   {'b', 'd', 'f', 'k', 'l'},
+                                   {'b', 'd', 'f', 'g', 'q'},
+                                   {'c'},
+                                   {},
+                                   {255, 255, 255},
+                                   {255}};
+    Tree eager;
+    Tree deferred(Tree::LeafHashing::deferred);
+    for (Byte round = 0; round < 3; ++round) {
+        for (const auto& key : keys) {
+            eager.insert(ByteSequence{key}, ByteSequence{'v', round});
+            deferred.insert(ByteSequence{key}, ByteSequence{'v', round});
+        }
+        // pending leaves are hashed on lookup
+        for (const auto& key : keys) {
+            auto lookup = deferred.find(key);
+            ASSERT_TRUE(lookup.found);
+            ASSERT_TRUE(compareHashes(lookup.leafHash, HashOfLeaf(key, {'v', round}).hash()));
+        }
+        eager.calculateHash();
+        deferred.calculateHash();
+        ASSERT_TRUE(compareHashes(eager.getRootNode()->hash(), deferred.getRootNode()->hash()));
+        ASSERT_EQ(eager.dbSize(), deferred.dbSize());
+    }
+    if constexpr (kStatsEnabled) {
+        ASSERT_EQ(eager.counters().leafHashes.load(), 3 * keys.size());
+        ASSERT_EQ(deferred.counters().leafHashes.load(), 3 * keys.size());
+        // a key overwritten before the commit is hashed once
+        for (Byte round = 0; round < 10; ++round) {
+            deferred.insert(ByteSequence{'c'}, ByteSequence{'w', round});
+        }
+        deferred.calculateHash();
+        ASSERT_EQ(deferred.counters().leafHashes.load(), 3 * keys.size() + 1);
+        auto lookup = deferred.find(ByteSequence{'c'});
+        ASSERT_TRUE(compareHashes(lookup.leafHash, HashOfLeaf({'c'}, {'w', 9}).hash()));
+    }
+}
+
+TEST(Tree, insert_overloads) {
+    // keys and values living in one caller owned buffer
+    const ByteSequence buffer{'b', 'd', 'f', 'k', 'l', 'm', 'b', 'd', 'f', 'g', 'q', 'c', 'v', 'w'};
+    ByteSequenceView view{buffer};
+    std::vector<std::pair<ByteSequenceView, ByteSequenceView>> kvs{
+        {view.subspan(0, 6), view.subspan(12, 1)},
+        {view.subspan(0, 5), view.subspan(12, 2)},
+        {view.subspan(6, 5), view.subspan(12, 1)},
+        {view.subspan(11, 1), view.subspan(13, 1)},
+        {view.subspan(0, 0), view.subspan(12, 1)},
+        // update
+        {view.subspan(0, 5), view.subspan(13, 1)}};
+
+    Tree owned;
+    Tree views;
+    Tree deferredViews(Tree::LeafHashing::deferred);
+    Tree precomputed;
+    for (const auto& [key, value] : kvs) {
+        owned.insert(ByteSequence{key.begin(), key.end()}, ByteSequence{value.begin(), value.end()});
+        views.insert(key, value);
+        deferredViews.insert(key, value);
+        unsigned char leafHash[SHA256_DIGEST_LENGTH];
+        HashOfLeaf::computeHash(key, value, leafHash);
+        precomputed.insertLeafHash(key, leafHash);
+    }
+    for (auto* tree : {&owned, &views, &deferredViews, &precomputed}) {
+        tree->calculateHash();
+        ASSERT_EQ(tree->dbSize(), owned.dbSize());
+        ASSERT_TRUE(compareHashes(tree->getRootNode()->hash(), owned.getRootNode()->hash()));
+    }
+    // lvalue sequences bind to the view overload
+    ByteSequence key{'c'};
+    ByteSequence value{'x'};
+    views.insert(key, value);
+    ASSERT_EQ(key, ByteSequence{'c'});
+    ASSERT_TRUE(compareHashes(views.find(key).leafHash, HashOfLeaf(key, value).hash()));
+    if constexpr (kStatsEnabled) {
+        ASSERT_EQ(precomputed.counters().leafHashes.load(), 0);
+    }
+}
+
+TEST(Tree, skip_unchanged_writes) {
+    const std::vector<ByteSequence> keys{{}, {'a'}, {'a', 'b'}, {'a', 'c', 'd'}, {'b'}, {'b', 'x'}};
+    for (auto leafHashing : {Tree::LeafHashing::eager, Tree::LeafHashing::deferred}) {
+        Tree tree(leafHashing, Tree::UnchangedWrites::skip);
+        Tree reference;
+        for (const auto& key : keys) {
+            tree.insert(ByteSequence{key}, ByteSequence{'v'});
+            reference.insert(ByteSequence{key}, ByteSequence{'v'});
+        }
+        tree.calculateHash();
+        reference.calculateHash();
+        // rewriting the same values leaves every node clean
+        for (const auto& key : keys) {
+            tree.insert(ByteSequence{key}, ByteSequence{'v'});
+            tree.insert(ByteSequenceView{key}, ByteSequenceView{ByteSequence{'v'}});
+        }
+        tree.calculateHash();
+        ASSERT_EQ(tree.numDirtynodes_, 0);
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+        if constexpr (kStatsEnabled) {
+            ASSERT_EQ(tree.counters().unchangedWrites.load(), 2 * keys.size());
+            ASSERT_EQ(tree.counters().lastCommitBranchHashes.load(), 1);
+        }
+        // a new value, then the old one again, both applied
+        for (const auto& value : {ByteSequence{'w'}, ByteSequence{'v'}}) {
+            tree.insert(ByteSequence{'a', 'c', 'd'}, ByteSequence{value});
+            reference.insert(ByteSequence{'a', 'c', 'd'}, ByteSequence{value});
+            tree.calculateHash();
+            reference.calculateHash();
+            ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+        }
+        // a value written twice between commits, pending in the deferred tree
+        auto skipped = tree.counters().unchangedWrites.load();
+        tree.insert(ByteSequence{'a'}, ByteSequence{'w'});
+        tree.insert(ByteSequenceView{ByteSequence{'a'}}, ByteSequenceView{ByteSequence{'w'}});
+        if constexpr (kStatsEnabled) {
+            ASSERT_EQ(tree.counters().unchangedWrites.load(), skipped + 1);
+        }
+        tree.insert(ByteSequence{'a'}, ByteSequence{'v'});
+        tree.calculateHash();
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+        // a leaf hash written directly is compared like any other
+        unsigned char leafHash[SHA256_DIGEST_LENGTH];
+        HashOfLeaf::computeHash(ByteSequence{'b'}, ByteSequence{'z'}, leafHash);
+        tree.insertLeafHash(ByteSequence{'b'}, leafHash);
+        tree.insert(ByteSequence{'b'}, ByteSequence{'v'});
+        tree.calculateHash();
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+        HashOfLeaf::computeHash(ByteSequence{'b'}, ByteSequence{'v'}, leafHash);
+        tree.insertLeafHash(ByteSequence{'b'}, leafHash);
+        tree.calculateHash();
+        tree.insert(ByteSequence{'b'}, ByteSequence{'v'});
+        tree.calculateHash();
+        ASSERT_EQ(tree.numDirtynodes_, 0);
+        // a value that only differs in a byte is not taken for the same
+        tree.insert(ByteSequence{'b'}, ByteSequence{'v', 0});
+        reference.insert(ByteSequence{'b'}, ByteSequence{'v', 0});
+        tree.calculateHash();
+        reference.calculateHash();
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+    }
+
+    // fingerprints from the caller, only compared when the tree skips unchanged writes
+    for (auto unchangedWrites : {Tree::UnchangedWrites::skip, Tree::UnchangedWrites::apply}) {
+        auto skips = unchangedWrites == Tree::UnchangedWrites::skip;
+        Tree tree(Tree::LeafHashing::eager, unchangedWrites);
+        Tree reference;
+        for (const auto& key : keys) {
+            tree.insert(key, ByteSequence{'v'}, 7);
+            reference.insert(ByteSequence{key}, ByteSequence{'v'});
+        }
+        tree.calculateHash();
+        tree.insert(ByteSequence{'a', 'b'}, ByteSequence{'v'}, 7);
+        tree.calculateHash();
+        ASSERT_EQ(tree.numDirtynodes_ == 0, skips);
+        tree.insert(ByteSequence{'a', 'b'}, ByteSequence{'w'}, 8);
+        reference.insert(ByteSequence{'a', 'b'}, ByteSequence{'w'});
+        tree.calculateHash();
+        reference.calculateHash();
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+        // kNoFingerprint never matches, not even itself
+        tree.insert(ByteSequence{'b'}, ByteSequence{'v'}, HashOfLeaf::kNoFingerprint);
+        tree.calculateHash();
+        tree.insert(ByteSequence{'b'}, ByteSequence{'v'}, HashOfLeaf::kNoFingerprint);
+        tree.calculateHash();
+        ASSERT_NE(tree.numDirtynodes_, 0);
+        ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+    }
+}
+
+TEST(Tree, subtree_hash) {
+    auto tenantKey = [](Byte tenant, Byte i) { return ByteSequence{'t', tenant, '/', 'k', i}; };
+    Tree tree;
+    Tree reference;
+    for (Byte tenant : {'a', 'b', 'c'}) {
+        for (Byte i = 0; i < 20; ++i) {
+            tree.insert(tenantKey(tenant, i), ByteSequence{'v'});
+            reference.insert(tenantKey(tenant, i), ByteSequence{'v'});
+        }
+    }
+    reference.calculateHash();
+    // prefixes ending before, inside and at the end of the tenant node's extension
+    ASSERT_EQ(tree.findSubtree(ByteSequence{}), ByteSequence{});
+    ASSERT_EQ(tree.findSubtree(ByteSequence{'t'}), ByteSequence{'t'});
+    ASSERT_EQ(tree.findSubtree(ByteSequence{'t', 'a'}), (ByteSequence{'t', 'a'}));
+    ASSERT_EQ(tree.findSubtree(ByteSequence{'t', 'a', '/'}), (ByteSequence{'t', 'a'}));
+    ASSERT_EQ(tree.findSubtree(ByteSequence{'t', 'a', '/', 'k'}), (ByteSequence{'t', 'a'}));
+    ASSERT_FALSE(tree.findSubtree(ByteSequence{'t', 'd'}).has_value());
+    ASSERT_FALSE(tree.findSubtree(ByteSequence{'t', 'a', 'x'}).has_value());
+    // a single leaf
+    ASSERT_FALSE(tree.findSubtree(tenantKey('a', 3)).has_value());
+    ASSERT_EQ(tree.calculateSubtreeHash(ByteSequence{'x'}), nullptr);
+
+    // tenants commit concurrently, each gets the hash a full commit gives its node
+    std::vector<std::thread> threads;
+    for (Byte tenant : {'a', 'b', 'c'}) {
+        threads.emplace_back([&tree, tenant] {
+            auto dbKey = *tree.findSubtree(ByteSequence{'t', tenant});
+            tree.calculateSubtreeHash(dbKey);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (Byte tenant : {'a', 'b', 'c'}) {
+        ByteSequence dbKey{'t', tenant};
+        ASSERT_TRUE(compareHashes(tree.getBranchNode(dbKey)->hash(),
+                                  reference.getBranchNode(dbKey)->hash()));
+    }
+
+    // an update is hashed again in its tenant only, then folded into the root
+    tree.insert(tenantKey('b', 4), ByteSequence{'w'});
+    reference.insert(tenantKey('b', 4), ByteSequence{'w'});
+    reference.calculateHash();
+    const auto* hash = tree.calculateSubtreeHash(ByteSequence{'t', 'b'});
+    ASSERT_TRUE(compareHashes(hash, reference.getBranchNode(ByteSequence{'t', 'b'})->hash()));
+    tree.calculateHash();
+    // only the top nodes of the tenants committed on their own and the node above them
+    ASSERT_EQ(tree.numDirtynodes_, 4);
+    ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+    ASSERT_TRUE(compareHashes(tree.calculateSubtreeHash(ByteSequence{}), tree.getRootNode()->hash()));
+}
+
+TEST(Tree, for_each_branch_node) {
+    Tree tree;
+    std::mt19937 gen(13);
+    for (int i = 0; i < 1000; ++i) {
+        ByteSequence key(1 + gen() % 8);
+        for (auto& b : key) {
+            b = static_cast<Byte>(gen() % 4);
+        }
+        tree.insert(std::move(key), ByteSequence{'v'});
+    }
+    std::vector<ByteSequence> dbKeys;
+    tree.forEachBranchNode([&](ByteSequenceView dbKey, const BranchNode& node) {
+        ASSERT_EQ(tree.getBranchNode(dbKey).get(), &node);
+        dbKeys.emplace_back(dbKey.begin(), dbKey.end());
+    });
+    ASSERT_EQ(dbKeys.size(), tree.dbSize());
+    ASSERT_TRUE(std::is_sorted(dbKeys.begin(), dbKeys.end(), LessThan{}));
+    ASSERT_TRUE(std::adjacent_find(dbKeys.begin(), dbKeys.end()) == dbKeys.end());
+}
+
+TEST(Tree, parallel_commit) {
+    for (auto leafHashing : {Tree::LeafHashing::eager, Tree::LeafHashing::deferred}) {
+        std::mt19937 gen(12);
+        Tree tree(leafHashing);
+        ThreadPool pool(4);
+        std::vector<std::pair<ByteSequence, ByteSequence>> kvs;
+        for (int block = 0; block < 5; ++block) {
+            // wide blocks so that the lower levels are split across the pool
+            for (int i = 0; i < 2000; ++i) {
+                ByteSequence key(1 + gen() % 4);
+                for (auto& b : key) {
+                    b = static_cast<Byte>(gen() % 16);
+                }
+                tree.insert(ByteSequence{key}, ByteSequence{static_cast<Byte>(block)});
+                kvs.emplace_back(std::move(key), ByteSequence{static_cast<Byte>(block)});
+            }
+            tree.calculateHash(pool);
+            Tree reference;
+            for (const auto& [key, value] : kvs) {
+                reference.insert(ByteSequence{key}, ByteSequence{value});
+            }
+            reference.calculateHash();
+            ASSERT_TRUE(compareHashes(tree.getRootNode()->hash(), reference.getRootNode()->hash()));
+            ASSERT_EQ(reference.numDirtynodes_, reference.dbSize());
+        }
+        // nothing left dirty
+        tree.calculateHash(pool);
+        ASSERT_EQ(tree.numDirtynodes_, 0);
+    }
 }
 
 int main(int argc, char** argv) {
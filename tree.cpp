@@ -5,13 +5,160 @@
 #include <tuple>
 
 namespace merkle {
+namespace {
+// A leaf for the slot at the end of an insert, writeLeaf sets its hash or pending value.
+template <typename WriteLeaf>
+std::unique_ptr<Node> createLeaf(ByteSequenceView extension, WriteLeaf& writeLeaf) {
+    auto leaf = std::make_unique<HashOfLeaf>();
+    leaf->setExtension(ByteSequence{extension.begin(), extension.end()});
+    writeLeaf(*leaf);
+    return leaf;
+}
+
+// The steps of a lookup in findBatch, each one touches the memory the previous one prefetched.
+enum class FindStep : uint8_t { locateBranch, matchBranch, loadChild, matchChild, idle };
+
+struct FindCursor {
+    ExtensionView extension;
+    Tree::LookupResult* lookup;
+    const BranchNode* branchNode;
+    const Node* child;
+    Byte childByte;
+    FindStep step;
+};
+
+void foundLeaf(const Node* leaf, Tree::LookupResult& lookup) {
+    lookup.found = true;
+    static_cast<const HashOfLeaf*>(leaf)->hashInto(lookup.leafHash);
+}
+}  // namespace
+
 void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
+    counters_.inserts.add();
+    WriteDigest digest;
+    if (unchangedWrites_ == UnchangedWrites::skip && skipUnchangedWrite(key, value, digest)) {
+        return;
+    }
+    if (digest.computed) {
+        auto writeLeaf = [&digest](HashOfLeaf& leaf) { leaf.setHash(digest.hash); };
+        insertLeaf(key, writeLeaf);
+        return;
+    }
+    if (leafHashing_ == LeafHashing::deferred) {
+        // the leaf takes the buffers, moving keeps the key's data so views into it stay valid
+        auto keyView = ByteSequenceView{key};
+        auto writeLeaf = [&key, &value](HashOfLeaf& leaf) {
+            leaf.setPending(std::move(key), std::move(value));
+        };
+        insertLeaf(keyView, writeLeaf);
+        return;
+    }
+    counters_.leafHashes.add();
+    auto writeLeaf = [&key, &value](HashOfLeaf& leaf) { leaf.updateHash(key, value); };
+    insertLeaf(key, writeLeaf);
+}
+
+void Tree::insert(ByteSequenceView key, ByteSequenceView value) {
+    counters_.inserts.add();
+    WriteDigest digest;
+    if (unchangedWrites_ == UnchangedWrites::skip && skipUnchangedWrite(key, value, digest)) {
+        return;
+    }
+    if (digest.computed) {
+        auto writeLeaf = [&digest](HashOfLeaf& leaf) { leaf.setHash(digest.hash); };
+        insertLeaf(key, writeLeaf);
+        return;
+    }
+    if (leafHashing_ == LeafHashing::deferred) {
+        auto writeLeaf = [key, value](HashOfLeaf& leaf) {
+            leaf.setPending(ByteSequence{key.begin(), key.end()},
+                            ByteSequence{value.begin(), value.end()});
+        };
+        insertLeaf(key, writeLeaf);
+        return;
+    }
+    counters_.leafHashes.add();
+    auto writeLeaf = [key, value](HashOfLeaf& leaf) { leaf.updateHash(key, value); };
+    insertLeaf(key, writeLeaf);
+}
+
+void Tree::insert(ByteSequenceView key, ByteSequenceView value, uint64_t fingerprint) {
+    counters_.inserts.add();
+    if (unchangedWrites_ == UnchangedWrites::skip && skipUnchangedWrite(key, fingerprint)) {
+        return;
+    }
+    if (leafHashing_ == LeafHashing::deferred) {
+        auto writeLeaf = [key, value, fingerprint](HashOfLeaf& leaf) {
+            leaf.setPending(ByteSequence{key.begin(), key.end()},
+                            ByteSequence{value.begin(), value.end()});
+            leaf.setValueFingerprint(fingerprint);
+        };
+        insertLeaf(key, writeLeaf);
+        return;
+    }
+    counters_.leafHashes.add();
+    auto writeLeaf = [key, value, fingerprint](HashOfLeaf& leaf) {
+        leaf.updateHash(key, value);
+        leaf.setValueFingerprint(fingerprint);
+    };
+    insertLeaf(key, writeLeaf);
+}
+
+bool Tree::skipUnchangedWrite(ByteSequenceView key, ByteSequenceView value, WriteDigest& digest) {
+    size_t nodesVisited = 0;
+    const auto* leaf = findLeaf(key, nodesVisited);
+    if (leaf == nullptr) {
+        return false;
+    }
+    // A pending value is compared as it is. A hashed leaf is compared by the hash of key and
+    // value, which is collision resistant unlike a short digest of the value would be.
+    if (const auto* pending = leaf->pendingValue()) {
+        if (!CompareBytes{}(*pending, value)) {
+            return false;
+        }
+    } else {
+        counters_.leafHashes.add();
+        HashOfLeaf::computeHash(key, value, digest.hash);
+        digest.computed = true;
+        if (!compareHashes(digest.hash, leaf->hash())) {
+            return false;
+        }
+    }
+    counters_.unchangedWrites.add();
+    return true;
+}
+
+bool Tree::skipUnchangedWrite(ByteSequenceView key, uint64_t fingerprint) {
+    if (fingerprint == HashOfLeaf::kNoFingerprint) {
+        return false;
+    }
+    size_t nodesVisited = 0;
+    const auto* leaf = findLeaf(key, nodesVisited);
+    if (leaf == nullptr || leaf->valueFingerprint() != fingerprint) {
+        return false;
+    }
+    counters_.unchangedWrites.add();
+    return true;
+}
+
+void Tree::insertLeafHash(ByteSequenceView key, const unsigned char* leafHash) {
+    counters_.inserts.add();
+    auto writeLeaf = [leafHash](HashOfLeaf& leaf) { leaf.setHash(leafHash); };
+    insertLeaf(key, writeLeaf);
+}
+
+template <typename WriteLeaf>
+void Tree::insertLeaf(ByteSequenceView key, WriteLeaf& writeLeaf) {
+    rootDirty_ = true;
     auto* branchNode = root_.get();
+    // the node holding the HashOfBranch of branchNode, null for the root
+    BranchNode* parentNode = nullptr;
+    Byte parentByte = 0;
     ExtensionView extension{key};
     while (true) {
         auto [result, matchBytes] = extension.compareTo(branchNode->extension());
         if (result == ExtensionView::CompareResultType::equals) {
-            branchNode->setLeaf(key, value);
+            writeLeaf(branchNode->getMutableLeaf());
             return;
         } else if (result == ExtensionView::CompareResultType::contains_other_extension) {
             // this means that the current branch node is on the path.
@@ -24,8 +171,7 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
             if (nodeType == Node::Type::NullNode) {
                 // Add the a leaf and set extension
                 auto leafExtension = extension.getExtentionFromCurrentPosition();
-                auto newLeaf = HashOfLeaf::createhashOfLeaf(
-                    key, value, ByteSequence{leafExtension.begin(), leafExtension.end()});
+                auto newLeaf = createLeaf(leafExtension, writeLeaf);
                 branchNode->swapNodeAtChild(currentByte, newLeaf);
                 return;
             } else if (nodeType == Node::Type::HashOfLeaf) {
@@ -34,7 +180,7 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
                     extension.compareTo(branchNode->getChildAt(currentByte)->extension());
                 if (result == ExtensionView::CompareResultType::equals) {
                     // it's an update
-                    branchNode->updateHashOfLeafChild(currentByte, key, value);
+                    writeLeaf(branchNode->getMutableLeafChild(currentByte));
                     return;
                 }
                 // the new inserted key and the existing leaf, shares a common path i.e. we need to
@@ -56,10 +202,8 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
                 auto optNewLeafCurrentByte = extension.getCurrentByte();
                 // if current byte is nullopt it means that its path terminates at this node
                 extension.incrementPositionBy(1);
-                auto hashofleaf = HashOfLeaf::createhashOfLeaf(
-                    key, value,
-                    ByteSequence{extension.getExtentionFromCurrentPosition().begin(),
-                                 extension.getExtentionFromCurrentPosition().end()});
+                auto hashofleaf =
+                    createLeaf(extension.getExtentionFromCurrentPosition(), writeLeaf);
                 cnps.emplace_back(std::make_pair(std::ref(hashofleaf), optNewLeafCurrentByte));
 
                 auto newBranchNode = BranchNode::createBranchNode(
@@ -69,8 +213,9 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
                 auto nodeToSwap = newBranchNode->createHashOfBranchForThisNode();
                 branchNode->swapNodeAtChild(currentByte, nodeToSwap);
 
-                db_.emplace(ByteSequence{newBranchNodeKey.begin(), newBranchNodeKey.end()},
-                            newBranchNode.release());
+                counters_.insertDbLookups.add();
+                markDirty(newBranchNodeKey);
+                emplaceBranchNode(newBranchNodeKey, std::move(newBranchNode));
                 return;
             } else if (nodeType == Node::Type::HashOfBranch) {
                 // TODO This is the only place we go to the next iteration. we need to stack the prv
@@ -79,7 +224,13 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
                 // it? it can contradict the fact that we may need to change the hashof branch
                 // extension. so we need hashofbranch exntesion?
                 auto nextbranchDbKey = extension.getKeySoFar();
-                branchNode->setDirty(currentByte, true);
+                // a dirty slot's node is in the dirty set already
+                if (!branchNode->isDirty(currentByte)) {
+                    branchNode->setDirty(currentByte, true);
+                    markDirty(nextbranchDbKey);
+                }
+                parentNode = branchNode;
+                parentByte = currentByte;
                 branchNode = getMutableBranchNode(nextbranchDbKey).get();
                 assert(branchNode != nullptr);
             } else {
@@ -97,10 +248,7 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
             auto leafPos = extension.getCurrentByte();
             // assert(leafPos == std::nullopt);
             extension.incrementPositionBy(1);
-            auto hashofleaf = HashOfLeaf::createhashOfLeaf(
-                key, value,
-                ByteSequence{extension.getExtentionFromCurrentPosition().begin(),
-                             extension.getExtentionFromCurrentPosition().end()});
+            auto hashofleaf = createLeaf(extension.getExtentionFromCurrentPosition(), writeLeaf);
             std::vector<BranchNode::ChildAndPos> cnps;
             cnps.emplace_back(std::make_pair(std::ref(hashofleaf), leafPos));
             // truncate the extension of the older branchnode
@@ -112,6 +260,10 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
             cnps.emplace_back(std::make_pair(std::ref(hashOfBranch), nextByte));
             auto newBranchNode = BranchNode::createBranchNode(
                 ByteSequence{newExtensionView.begin(), newExtensionView.end()}, cnps);
+            // the parent's HashOfBranch mirrors the extension of the node it points to
+            if (parentNode != nullptr) {
+                parentNode->updateHashOfBranchExtension(parentByte, newBranchNode->extension());
+            }
 
             // At this phase the new branch node is ready with the leaf and pointing to the old
             // branch node, need to set it in the db with the key of the old branchnode
@@ -119,7 +271,9 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
             mutableBranchNode.swap(newBranchNode);
             auto newDbKEy = ByteSequence{newDbKeyView.begin(), newDbKeyView.end()};
             newDbKEy.push_back(nextByte);
-            db_.emplace(std::move(newDbKEy), newBranchNode.release());
+            counters_.insertDbLookups.add();
+            markDirty(newDbKEy);
+            emplaceBranchNode(newDbKEy, std::move(newBranchNode));
             return;
         } else {
             assert(false);
@@ -127,11 +281,283 @@ void Tree::insert(ByteSequence&& key, ByteSequence&& value) {
     }
 }
 
-// Calculate the root hash by traversing only dirty paths.
+Tree::LookupResult Tree::find(ByteSequenceView key) const {
+    LookupResult lookup;
+    const auto* leaf = findLeaf(key, lookup.nodesVisited);
+    if (leaf != nullptr) {
+        lookup.found = true;
+        leaf->hashInto(lookup.leafHash);
+    }
+    return lookup;
+}
+
+const HashOfLeaf* Tree::findLeaf(ByteSequenceView key, size_t& nodesVisited) const {
+    const auto* branchNode = root_.get();
+    ExtensionView extension{key};
+    while (true) {
+        ++nodesVisited;
+        auto [result, matchBytes] = extension.compareTo(branchNode->extension());
+        const Node* leaf = nullptr;
+        if (result == ExtensionView::CompareResultType::equals) {
+            leaf = branchNode->getChildAt(BranchNode::LeafChildPos).get();
+            nodesVisited += leaf != nullptr;
+        } else if (result == ExtensionView::CompareResultType::contains_other_extension) {
+            extension.incrementPositionBy(matchBytes);
+            auto currentByte = *extension.getCurrentByte();
+            extension.incrementPositionBy(1);
+            const auto& child = branchNode->getChildAt(currentByte);
+            if (child == nullptr) {
+                return nullptr;
+            }
+            if (child->getType() == Node::Type::HashOfBranch) {
+                branchNode = getBranchNode(extension.getKeySoFar()).get();
+                assert(branchNode != nullptr);
+                continue;
+            }
+            ++nodesVisited;
+            auto [leafResult, leafMatchBytes] = extension.compareTo(child->extension());
+            if (leafResult == ExtensionView::CompareResultType::equals) {
+                leaf = child.get();
+            }
+        }
+        // substring or diverge means the key ends or leaves the path inside this node's extension
+        return static_cast<const HashOfLeaf*>(leaf);
+    }
+}
+
+void Tree::findBatch(std::span<const ByteSequenceView> keys, std::span<LookupResult> results,
+                     size_t group) const {
+    assert(results.size() >= keys.size());
+    size_t next = 0;
+    std::vector<FindCursor> cursors;
+    auto numCursors = std::min(std::max<size_t>(group, 1), keys.size());
+    cursors.reserve(numCursors);
+    auto startNext = [&](FindCursor& cursor) {
+        if (next == keys.size()) {
+            cursor.step = FindStep::idle;
+            return false;
+        }
+        results[next] = LookupResult{};
+        cursor = FindCursor{ExtensionView{keys[next]}, &results[next], root_.get(), nullptr, 0,
+                            FindStep::matchBranch};
+        ++next;
+        return true;
+    };
+    while (cursors.size() < numCursors) {
+        cursors.push_back(FindCursor{ExtensionView{ByteSequenceView{}}, nullptr, nullptr, nullptr,
+                                     0, FindStep::idle});
+        startNext(cursors.back());
+    }
+
+    // The same walk as find, cut at every dependent load. Returns false once the lookup is done.
+    auto advance = [this](FindCursor& cursor) {
+        auto& lookup = *cursor.lookup;
+        switch (cursor.step) {
+            case FindStep::locateBranch:
+                cursor.branchNode = getBranchNode(cursor.extension.getKeySoFar()).get();
+                assert(cursor.branchNode != nullptr);
+                __builtin_prefetch(cursor.branchNode);
+                cursor.step = FindStep::matchBranch;
+                return true;
+            case FindStep::matchBranch: {
+                ++lookup.nodesVisited;
+                const auto* branchNode = cursor.branchNode;
+                auto [result, matchBytes] = cursor.extension.compareTo(branchNode->extension());
+                if (result == ExtensionView::CompareResultType::equals) {
+                    const auto* leaf = branchNode->getChildAt(BranchNode::LeafChildPos).get();
+                    if (leaf != nullptr) {
+                        ++lookup.nodesVisited;
+                        foundLeaf(leaf, lookup);
+                    }
+                    return false;
+                }
+                if (result != ExtensionView::CompareResultType::contains_other_extension) {
+                    return false;
+                }
+                cursor.extension.incrementPositionBy(matchBytes);
+                cursor.childByte = *cursor.extension.getCurrentByte();
+                cursor.extension.incrementPositionBy(1);
+                __builtin_prefetch(&branchNode->getChildAt(cursor.childByte));
+                cursor.step = FindStep::loadChild;
+                return true;
+            }
+            case FindStep::loadChild:
+                cursor.child = cursor.branchNode->getChildAt(cursor.childByte).get();
+                if (cursor.child == nullptr) {
+                    return false;
+                }
+                __builtin_prefetch(cursor.child);
+                cursor.step = FindStep::matchChild;
+                return true;
+            case FindStep::matchChild: {
+                if (cursor.child->getType() == Node::Type::HashOfBranch) {
+                    cursor.step = FindStep::locateBranch;
+                    return true;
+                }
+                ++lookup.nodesVisited;
+                auto [leafResult, leafMatchBytes] =
+                    cursor.extension.compareTo(cursor.child->extension());
+                if (leafResult == ExtensionView::CompareResultType::equals) {
+                    foundLeaf(cursor.child, lookup);
+                }
+                return false;
+            }
+            case FindStep::idle:
+                break;
+        }
+        return false;
+    };
+
+    size_t inFlight = cursors.size();
+    while (inFlight > 0) {
+        for (auto& cursor : cursors) {
+            if (cursor.step != FindStep::idle && !advance(cursor) && !startNext(cursor)) {
+                --inFlight;
+            }
+        }
+    }
+}
+
 void Tree::calculateHash() {
-    numDirtynodes_ = 0;
-    auto* node = root_.get();
-    ByteSequence key;
+    ScopedTimer commitTimer(counters_.commitNanos);
+    counters_.commits.add();
+    counters_.lastCommitBranchHashes.store(0);
+    numDirtynodes_ = hashDirtySet(nullptr);
+}
+
+void Tree::calculateHash(ThreadPool& pool) {
+    ScopedTimer commitTimer(counters_.commitNanos);
+    counters_.commits.add();
+    counters_.lastCommitBranchHashes.store(0);
+    numDirtynodes_ = hashDirtySet(&pool);
+}
+
+namespace {
+// levels with fewer dirty nodes are hashed on the calling thread
+constexpr size_t kMinParallelLevelNodes = 64;
+
+struct DirtyNode {
+    BranchNode* node;
+    // the node holding its HashOfBranch
+    BranchNode* parent;
+    Byte byte;
+};
+}  // namespace
+
+size_t Tree::hashDirtySet(ThreadPool* pool) {
+    // Resolve the parent of every dirty node by walking the set in LessThan order with the stack
+    // of its dirty ancestors: the parent is the nearest one whose db key is a prefix of the node's.
+    std::vector<std::vector<DirtyNode>> levels;
+    std::vector<std::pair<ByteSequenceView, BranchNode*>> ancestors{
+        {ByteSequenceView{}, root_.get()}};
+    for (const auto& dbKey : dirty_) {
+        while (ancestors.size() > 1 &&
+               (ancestors.back().first.size() >= dbKey.size() ||
+                !std::equal(ancestors.back().first.begin(), ancestors.back().first.end(),
+                            dbKey.begin()))) {
+            ancestors.pop_back();
+        }
+        auto [parentKey, parent] = ancestors.back();
+        auto byte = dbKey[parentKey.size() + parent->extension().size()];
+        auto* node = getBranchNode(dbKey).get();
+        assert(node != nullptr);
+        ancestors.emplace_back(ByteSequenceView{dbKey}, node);
+        // a subtree committed on its own with calculateSubtreeHash is clean below its top node
+        if (!parent->isDirty(byte)) {
+            continue;
+        }
+        auto depth = ancestors.size() - 1;
+        if (levels.size() < depth) {
+            levels.resize(depth);
+        }
+        levels[depth - 1].push_back(DirtyNode{node, parent, byte});
+    }
+
+    auto hashNode = [this](BranchNode* node) {
+        if (leafHashing_ == LeafHashing::deferred) {
+            // every node holding a pending leaf is dirty
+            counters_.leafHashes.add(node->resolvePendingLeaves());
+        }
+        node->computeHash(branchHashing_);
+        counters_.branchHashes.add();
+        counters_.lastCommitBranchHashes.add();
+    };
+    // nodes of one level are hashed independently, each writes only its own HashOfBranch
+    auto hashLevel = [&hashNode](std::span<const DirtyNode> level) {
+        for (const auto& dirty : level) {
+            hashNode(dirty.node);
+            dirty.parent->updateHashOfBranchHash(dirty.byte, dirty.node->hash());
+            dirty.parent->setDirty(dirty.byte, false);
+        }
+    };
+    size_t hashed = 0;
+    {
+        ScopedTimer hashTimer(counters_.commitHashNanos);
+        for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+            hashed += level->size();
+            if (pool == nullptr || pool->size() < 2 || level->size() < kMinParallelLevelNodes) {
+                hashLevel(*level);
+                continue;
+            }
+            std::span<const DirtyNode> nodes{*level};
+            auto chunkSize = (nodes.size() + pool->size() - 1) / pool->size();
+            std::vector<std::future<void>> pending;
+            for (size_t begin = 0; begin < nodes.size(); begin += chunkSize) {
+                auto chunk = nodes.subspan(begin, std::min(chunkSize, nodes.size() - begin));
+                pending.push_back(pool->submit([&hashLevel, chunk] { hashLevel(chunk); }));
+            }
+            for (auto& future : pending) {
+                future.get();
+            }
+        }
+        hashNode(root_.get());
+    }
+    dirty_.clear();
+    rootDirty_ = false;
+    return hashed;
+}
+
+const unsigned char* Tree::calculateSubtreeHash(ByteSequenceView dbKey) {
+    if (dbKey.empty()) {
+        calculateHash();
+        return root_->hash();
+    }
+    const auto* node = findInDb(dbKey);
+    if (node == nullptr) {
+        return nullptr;
+    }
+    hashDirtyPaths(node->get(), ByteSequence{dbKey.begin(), dbKey.end()});
+    return (*node)->hash();
+}
+
+std::optional<ByteSequence> Tree::findSubtree(ByteSequenceView prefix) const {
+    const auto* branchNode = root_.get();
+    ExtensionView extension{prefix};
+    while (true) {
+        auto [result, matchBytes] = extension.compareTo(branchNode->extension());
+        if (result == ExtensionView::CompareResultType::equals ||
+            result == ExtensionView::CompareResultType::substring) {
+            // the prefix ends within this node's path, every key below it starts with the prefix
+            return ByteSequence{extension.getKeySoFar().begin(), extension.getKeySoFar().end()};
+        }
+        if (result == ExtensionView::CompareResultType::diverge) {
+            return std::nullopt;
+        }
+        extension.incrementPositionBy(matchBytes);
+        auto currentByte = *extension.getCurrentByte();
+        extension.incrementPositionBy(1);
+        if (branchNode->getTypeOfChild(currentByte) != Node::Type::HashOfBranch) {
+            // nothing or a single leaf
+            return std::nullopt;
+        }
+        branchNode = getBranchNode(extension.getKeySoFar()).get();
+        assert(branchNode != nullptr);
+    }
+}
+
+size_t Tree::hashDirtyPaths(BranchNode* subtreeRoot, ByteSequence&& key) {
+    size_t numDirtyNodes = 0;
+    auto* node = subtreeRoot;
     std::stack<std::pair<BranchNode*, Byte>> nodes;
     while (true) {
         // Do depth search by looping over the current node children, if a dirty branch node is
@@ -146,7 +572,7 @@ void Tree::calculateHash() {
             if (child->getType() == Node::Type::HashOfBranch &&
                 static_cast<HashOfBranch*>(child.get())->isDirty()) {
                 // TODO set dirty false here?
-                ++numDirtynodes_;
+                ++numDirtyNodes;
                 key.insert(key.end(), node->extension().begin(), node->extension().end());
                 key.push_back(byte);
                 nodes.push(std::make_pair(node, byte));
@@ -162,10 +588,19 @@ void Tree::calculateHash() {
         }
         // When we reach here it means that the current node has not more dirty children and is
         // ready for its hash computation
-        node->computeHash();
+        {
+            ScopedTimer hashTimer(counters_.commitHashNanos);
+            if (leafHashing_ == LeafHashing::deferred) {
+                // every node holding a pending leaf is on a dirty path
+                counters_.leafHashes.add(node->resolvePendingLeaves());
+            }
+            node->computeHash(branchHashing_);
+        }
+        counters_.branchHashes.add();
+        counters_.lastCommitBranchHashes.add();
         if (nodes.empty()) {
-            // this is the root node.
-            return;
+            // this is the root of the subtree.
+            return numDirtyNodes;
         }
         auto topNodePair = nodes.top();
         nodes.pop();
@@ -183,6 +618,55 @@ void Tree::calculateHash() {
     }
 };
 
+TreeStats Tree::collectStats() const {
+    TreeStats stats;
+    ByteSequence scratch;
+    // branch node, its db key and depth
+    std::stack<std::tuple<const BranchNode*, ByteSequence, size_t>> pending;
+    pending.emplace(root_.get(), ByteSequence{}, 0);
+    while (!pending.empty()) {
+        auto [node, key, depth] = std::move(pending.top());
+        pending.pop();
+        ++stats.branchNodes;
+        ++stats.branchNodesByDepth[depth];
+        ++stats.branchExtensionLengths[node->extension().size()];
+        scratch.clear();
+        node->serialize(scratch);
+        stats.branchNodeBytes += scratch.size();
+
+        size_t occupied = 0;
+        const auto& leaf = node->getChildAt(BranchNode::LeafChildPos);
+        if (leaf != nullptr) {
+            ++occupied;
+            ++stats.leaves;
+            ++stats.leavesByDepth[depth];
+            ++stats.leafExtensionLengths[0];
+        }
+        key.insert(key.end(), node->extension().begin(), node->extension().end());
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            auto byte = static_cast<Byte>(i);
+            const auto& child = node->getChildAt(byte);
+            if (child == nullptr) {
+                continue;
+            }
+            ++occupied;
+            if (child->getType() == Node::Type::HashOfLeaf) {
+                ++stats.leaves;
+                ++stats.leavesByDepth[depth];
+                ++stats.leafExtensionLengths[child->extension().size()];
+                continue;
+            }
+            auto childKey = key;
+            childKey.push_back(byte);
+            const auto& childNode = getBranchNode(childKey);
+            assert(childNode != nullptr);
+            pending.emplace(childNode.get(), std::move(childKey), depth + 1);
+        }
+        ++stats.fanOut[occupied];
+    }
+    return stats;
+}
+
 void Tree::printTree() {
     using NodeInfo = std::tuple<size_t, ByteSequence, BranchNode*>;
     std::queue<NodeInfo> dfs;
@@ -201,11 +685,11 @@ void Tree::printTree() {
         for (Byte b : ev) {
             key.push_back(b);
         }
-        for (int i = 0; i < std::numeric_limits<Byte>::max(); ++i) {
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
             Byte b = static_cast<Byte>(i);
             if (node->getTypeOfChild(b) == Node::HashOfBranch) {
                 key.push_back(b);
-                dfs.push(std::make_tuple(level + 1, key, db_[key].get()));
+                dfs.push(std::make_tuple(level + 1, key, getBranchNode(key).get()));
                 key.pop_back();
             }
         }
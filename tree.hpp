@@ -1,56 +1,313 @@
+#include <cstdlib>
 #include <map>
+#include <random>
+#include <span>
+#ifdef KVMERKLE_COMPACT_DB_KEYS
+#include <unordered_map>
+#endif
 
+#include <set>
+
+#include "detail/stats.hpp"
+#include "detail/thread_pool.hpp"
 #include "nodes.hpp"
 
+#pragma once
+
 namespace merkle {
 class Tree {
    public:
+#ifdef KVMERKLE_COMPACT_DB_KEYS
+    // Branch nodes by a 128 bit SipHash of their db key under a random per process key, so the
+    // index takes a fixed size entry per node however long the keys are. It has no order and
+    // does not keep the db keys, walk the tree with forEachBranchNode for those. The low word
+    // files the node, the high word is kept with it as a check: a lookup of another key that
+    // lands on the entry finds nothing, and two db keys of the tree filed under one word abort
+    // rather than alias, which takes about 2^64 nodes by chance and can't be forced without the
+    // key.
+    struct DbEntry {
+        uint64_t check = 0;
+        std::unique_ptr<BranchNode> node;
+    };
+    using KVDB = std::unordered_map<uint64_t, DbEntry>;
+#else
     using KVDB = std::map<ByteSequence, std::unique_ptr<BranchNode>, LessThan>;
-    struct Proof {
-        BranchNode root;
-        KVDB db;
+#endif
+    struct LookupResult {
+        bool found = false;
+        // valid only when found
+        unsigned char leafHash[SHA256_DIGEST_LENGTH] = {};
+        // branch nodes on the path plus the leaf itself when it exists
+        size_t nodesVisited = 0;
     };
-    Tree() {
+    // eager hashes a leaf on every insert. deferred keeps the key and value in the leaf and hashes
+    // it in calculateHash, so a key written several times between commits is hashed once.
+    enum class LeafHashing : uint8_t { eager, deferred };
+    // skip compares a write with the leaf the key already has, by its pending value or else by
+    // the leaf hash, and leaves out a write of the same value, which then dirties no path. Costs
+    // a lookup per write, the leaf hash it takes is reused when the write goes ahead.
+    enum class UnchangedWrites : uint8_t { apply, skip };
+    // see merkle::BranchHashing, trees of different modes have different hashes for the same keys
+    using BranchHashing = merkle::BranchHashing;
+
+    Tree() : Tree(LeafHashing::eager) {}
+    explicit Tree(LeafHashing leafHashing, UnchangedWrites unchangedWrites = UnchangedWrites::apply,
+                  BranchHashing branchHashing = BranchHashing::flat)
+        : leafHashing_(leafHashing),
+          unchangedWrites_(unchangedWrites),
+          branchHashing_(branchHashing) {
         BranchNode::setNullNodeHash();
         root_ = BranchNode::createBranchNode();
     }
+    explicit Tree(BranchHashing branchHashing)
+        : Tree(LeafHashing::eager, UnchangedWrites::apply, branchHashing) {}
 
+    LeafHashing leafHashing() const { return leafHashing_; }
+    UnchangedWrites unchangedWrites() const { return unchangedWrites_; }
+    BranchHashing branchHashing() const { return branchHashing_; }
+
+    // With deferred leaf hashing, node hashes and serialized nodes are only meaningful after
+    // calculateHash, find hashes pending leaves on the fly.
     void insert(ByteSequence&& key, ByteSequence&& value);
+    // Reads key and value in place, e.g. from the caller's own buffers. The eager tree copies only
+    // extension fragments, the deferred tree copies both to hash them at commit.
+    void insert(ByteSequenceView key, ByteSequenceView value);
+    // With a fingerprint of the value from the caller, e.g. a digest its store keeps anyway. With
+    // UnchangedWrites::skip the write is skipped when the key's leaf was last written with the
+    // same fingerprint, in place of comparing the values. HashOfLeaf::kNoFingerprint, 0, is
+    // reserved for leaves written without one and never matches, a value whose digest comes out
+    // as 0 is always written. The tree takes fingerprints on trust: two values of one key
+    // must never share one, so they take a collision resistant digest, or a keyed one where the
+    // values come from outside, not a plain 64 bit hash. The writes of a key must all come with
+    // the caller's fingerprints or all without.
+    void insert(ByteSequenceView key, ByteSequenceView value, uint64_t valueFingerprint);
+    // For callers that already hashed the value, leafHash must be what HashOfLeaf::computeHash
+    // gives for the key and value. Never deferred as there is nothing left to hash.
+    void insertLeafHash(ByteSequenceView key, const unsigned char* leafHash);
+
+    // Descends like insert does but never mutates the tree, concurrent finds are safe as long as
+    // there is no concurrent insert or calculateHash.
+    LookupResult find(ByteSequenceView key) const;
+    // find for many keys at once, results[i] is find(keys[i]). Up to group lookups are in flight,
+    // each one prefetches the memory of its next step and yields to the others, so the cache
+    // misses of different keys overlap instead of stalling one after the other. Lookups only,
+    // generateMultiProof and insert still descend one key at a time.
+    void findBatch(std::span<const ByteSequenceView> keys, std::span<LookupResult> results,
+                   size_t group = kFindBatchGroup) const;
+    static constexpr size_t kFindBatchGroup = 16;
 
     template <typename SPAN>
     const std::unique_ptr<BranchNode>& getBranchNode(const SPAN& span) const {
         static const std::unique_ptr<BranchNode> kNotFound;
-        auto itr = db_.find(span);
-        if (itr == db_.end()) {
-            return kNotFound;
-        }
-        return itr->second;
+        const auto* node = findInDb(span);
+        return node == nullptr ? kNotFound : *node;
     }
 
     const std::unique_ptr<BranchNode>& getRootNode() const { return root_; }
 
+    // Hashes the branch nodes inserts touched since the last commit, straight from the dirty set:
+    // deepest level first, each node once, up to the root. With a pool, the levels with enough
+    // nodes are hashed across its threads.
     void calculateHash();
+    void calculateHash(ThreadPool& pool);
+    // Commits only the subtree of the branch node stored under dbKey, the empty key being the root,
+    // and returns its hash, null when there is no such node. The parent's HashOfBranch is left
+    // dirty, the next calculateHash folds the subtree into the root by hashing its top node again.
+    // Disjoint subtrees can be hashed concurrently as long as nothing inserts meanwhile.
+    const unsigned char* calculateSubtreeHash(ByteSequenceView dbKey);
+    // The db key of the branch node whose subtree holds exactly the keys that start with prefix,
+    // nullopt when no key or only a single leaf starts with it.
+    std::optional<ByteSequence> findSubtree(ByteSequenceView prefix) const;
     size_t dbSize() const { return db_.size(); }
-    const std::map<ByteSequence, std::unique_ptr<BranchNode>, LessThan>& getRoDB() const {
-        return db_;
+#ifndef KVMERKLE_COMPACT_DB_KEYS
+    const KVDB& getRoDB() const { return db_; }
+#endif
+
+    // Visits the branch nodes below the root as visit(ByteSequenceView dbKey, const BranchNode&),
+    // in db key order.
+    template <typename Visitor>
+    void forEachBranchNode(Visitor&& visit) const {
+        // db keys of the nodes left to visit, the next one on top
+        std::vector<ByteSequence> pending;
+        auto pushChildren = [this, &pending](ByteSequence prefix, const BranchNode& node) {
+            prefix.insert(prefix.end(), node.extension().begin(), node.extension().end());
+            for (int i = std::numeric_limits<Byte>::max(); i >= 0; --i) {
+                auto byte = static_cast<Byte>(i);
+                if (node.getTypeOfChild(byte) == Node::Type::HashOfBranch) {
+                    pending.push_back(prefix);
+                    pending.back().push_back(byte);
+                }
+            }
+        };
+        pushChildren(ByteSequence{}, *root_);
+        while (!pending.empty()) {
+            auto dbKey = std::move(pending.back());
+            pending.pop_back();
+            const auto& node = getBranchNode(dbKey);
+            assert(node != nullptr);
+            visit(ByteSequenceView{dbKey}, *node);
+            pushChildren(std::move(dbKey), *node);
+        }
     }
 
     void printTree();
 
-    // KVDB generateProof(const ByteSequenceView key) const;
+    // Streams the tree as a snapshot: a magic, the branch hashing and the root hash, then every
+    // branch node length prefixed and serialized, the root first and the others in db key order,
+    // then a zero length, the node count and a SHA-256 of all the bytes before it. Db keys are not
+    // written, the order gives them. False, with nothing written, when the tree has writes not yet
+    // committed with calculateHash, write errors are left in out's state. See snapshot.cpp.
+    bool exportSnapshot(std::ostream& out) const;
+    // Rebuilds a tree from an exported snapshot, with the branch hashing it was exported with,
+    // nullopt when it is truncated or corrupt. Each node is checked as it arrives against the hash
+    // its parent holds for it, and rehashed from its children in batches, on pool's threads when
+    // given one. Besides the tree itself only the children expected on the current path and the
+    // batches being hashed are held. Reads nothing past the checksum.
+    static std::optional<Tree> importSnapshot(std::istream& in,
+                                              LeafHashing leafHashing = LeafHashing::eager,
+                                              ThreadPool* pool = nullptr);
+
+    // Visits the leaves below node in lexicographic key order as visit(ByteSequenceView key, const
+    // Node& leaf). prefix is the full path of node, i.e. its db key followed by its extension, it
+    // is used as scratch space and restored before returning.
+    template <typename Visitor>
+    void forEachLeaf(const BranchNode& node, ByteSequence& prefix, Visitor&& visit) const {
+        const auto& leaf = node.getChildAt(BranchNode::LeafChildPos);
+        if (leaf != nullptr) {
+            visit(ByteSequenceView{prefix}, *leaf);
+        }
+        for (int i = 0; i <= std::numeric_limits<Byte>::max(); ++i) {
+            const auto& child = node.getChildAt(static_cast<Byte>(i));
+            if (child == nullptr) {
+                continue;
+            }
+            auto prefixSize = prefix.size();
+            prefix.push_back(static_cast<Byte>(i));
+            if (child->getType() == Node::Type::HashOfBranch) {
+                const auto& branchNode = getBranchNode(prefix);
+                assert(branchNode != nullptr);
+                auto ext = branchNode->extension();
+                prefix.insert(prefix.end(), ext.begin(), ext.end());
+                forEachLeaf(*branchNode, prefix, visit);
+            } else {
+                auto ext = child->extension();
+                prefix.insert(prefix.end(), ext.begin(), ext.end());
+                visit(ByteSequenceView{prefix}, *child);
+            }
+            prefix.resize(prefixSize);
+        }
+    }
+
+    template <typename Visitor>
+    void forEachLeaf(Visitor&& visit) const {
+        ByteSequence prefix;
+        forEachLeaf(*root_, prefix, visit);
+    }
+
+    // Walks the whole tree, meant for sizing and diagnostics rather than the hot path.
+    TreeStats collectStats() const;
+    const TreeCounters& counters() const { return counters_; }
 
     // counters
     size_t numDirtynodes_ = 0;
 
    private:
+    friend class TreeBuilder;
+
+#ifdef KVMERKLE_COMPACT_DB_KEYS
+    // drawn per process, so that keys from outside can't be picked to collide
+    static const SipKey& dbHashKey() {
+        static const SipKey kKey = [] {
+            std::random_device random;
+            auto draw = [&] { return (static_cast<uint64_t>(random()) << 32) | random(); };
+            return SipKey{draw(), draw()};
+        }();
+        return kKey;
+    }
+#endif
+    // The branch node under dbKey, null when there is none.
+    template <typename SPAN>
+    const std::unique_ptr<BranchNode>* findInDb(const SPAN& dbKey) const {
+#ifdef KVMERKLE_COMPACT_DB_KEYS
+        auto [index, check] = sipHash128(ByteSequenceView{dbKey}, dbHashKey());
+        auto itr = db_.find(index);
+        if (itr == db_.end() || itr->second.check != check) {
+            return nullptr;
+        }
+        return &itr->second.node;
+#else
+        // the map looks up views and sequences alike
+        auto itr = db_.find(ByteSequenceView{dbKey});
+        return itr == db_.end() ? nullptr : &itr->second;
+#endif
+    }
+    void emplaceBranchNode(ByteSequenceView dbKey, std::unique_ptr<BranchNode> node) {
+#ifdef KVMERKLE_COMPACT_DB_KEYS
+        auto [index, check] = sipHash128(dbKey, dbHashKey());
+        auto [itr, inserted] = db_.try_emplace(index, DbEntry{check, std::move(node)});
+        if (!inserted) {
+            // the other node can't be told apart on lookup anymore, carrying on would corrupt
+            // the tree
+            std::cerr << "kvmerkle: db index collision, db key " << dbKey << std::endl;
+            std::abort();
+        }
+#else
+        db_.emplace(ByteSequence{dbKey.begin(), dbKey.end()}, std::move(node));
+#endif
+    }
+
     template <typename SPAN>
     std::unique_ptr<BranchNode>& getMutableBranchNode(const SPAN& span) {
-        auto itr = db_.find(span);
-        assert(itr != db_.end());
-        return itr->second;
+        counters_.insertDbLookups.add();
+        const auto* node = findInDb(span);
+        assert(node != nullptr);
+        return const_cast<std::unique_ptr<BranchNode>&>(*node);
+    }
+
+    // The leaf of key, null when there is none. nodesVisited counts as LookupResult does.
+    const HashOfLeaf* findLeaf(ByteSequenceView key, size_t& nodesVisited) const;
+    // The hash of a written key and value once skipUnchangedWrite computed it, the write then
+    // takes it instead of hashing again.
+    struct WriteDigest {
+        bool computed = false;
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+    };
+    // Whether the leaf of key already holds value, in which case the write is counted as unchanged
+    // and left out.
+    bool skipUnchangedWrite(ByteSequenceView key, ByteSequenceView value, WriteDigest& digest);
+    // Whether the leaf of key was last written with fingerprint, likewise.
+    bool skipUnchangedWrite(ByteSequenceView key, uint64_t fingerprint);
+    // Descends to the leaf slot of key, reshaping the path as needed, and fills it with
+    // writeLeaf(HashOfLeaf&). Called exactly once per insert.
+    template <typename WriteLeaf>
+    void insertLeaf(ByteSequenceView key, WriteLeaf& writeLeaf);
+
+    // Records a branch node that an insert touched, by db key.
+    void markDirty(ByteSequenceView dbKey) {
+        if (dirty_.find(dbKey) == dirty_.end()) {
+            dirty_.emplace(dbKey.begin(), dbKey.end());
+        }
     }
+    // Hashes the nodes of dirty_ bottom up and then the root, returns how many were hashed besides
+    // the root.
+    size_t hashDirtySet(ThreadPool* pool);
+    // The dirty path DFS from any branch node, following the dirty flags of the HashOfBranch
+    // children, key is the node's db key. Returns the number of dirty nodes below it that were
+    // hashed.
+    size_t hashDirtyPaths(BranchNode* subtreeRoot, ByteSequence&& key);
 
+    LeafHashing leafHashing_;
+    UnchangedWrites unchangedWrites_;
+    BranchHashing branchHashing_;
     std::unique_ptr<BranchNode> root_;
     KVDB db_;
+    // db keys of the branch nodes touched since the last calculateHash, the root aside. Every
+    // ancestor of a dirty node is dirty too, and LessThan order puts it first. A node whose
+    // HashOfBranch is dirty is always in the set.
+    std::set<ByteSequence, LessThan> dirty_;
+    // the root hash is stale, from construction or any insert until the next calculateHash.
+    // calculateSubtreeHash leaves it set.
+    bool rootDirty_ = true;
+    TreeCounters counters_;
 };
 };  // namespace merkle
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "tree_builder.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#include "detail/thread_pool.hpp"
+
+namespace merkle {
+
+TreeBuilder::TreeBuilder(Tree::BranchHashing branchHashing) : tree_(branchHashing) {
+    frames_.push_back(Frame{0, BranchNode::createBranchNode()});
+}
+
+bool TreeBuilder::add(ByteSequenceView key, ByteSequenceView value) {
+    if (hasPending_) {
+        auto pendingView = ByteSequenceToView(pendingKey_);
+        if (CompareBytes{}(pendingView, key)) {
+            pendingValue_.assign(value.begin(), value.end());
+            return true;
+        }
+        // out of order input would attach the key to closed nodes and give a wrong root hash
+        if (!LessThan{}(pendingView, key)) {
+            return false;
+        }
+        // the pending key ends or leaves the path of the new key at the common prefix, every
+        // branch node below that point is complete.
+        auto shorterSize = std::min(pendingKey_.size(), key.size());
+        closeFramesAbove(findMismatch(pendingKey_.data(), key.data(), shorterSize));
+    }
+    pendingKey_.assign(key.begin(), key.end());
+    pendingValue_.assign(value.begin(), value.end());
+    hasPending_ = true;
+    ++numKeys_;
+    return true;
+}
+
+void TreeBuilder::closeFramesAbove(size_t depth) {
+    if (frames_.back().depth <= depth) {
+        if (frames_.back().depth < depth) {
+            // the pending key and the next key share a path that ends here.
+            frames_.push_back(Frame{depth, BranchNode::createBranchNode()});
+        }
+        attachPendingLeaf(frames_.back());
+        return;
+    }
+    attachPendingLeaf(frames_.back());
+    while (frames_.back().depth > depth) {
+        auto closed = std::move(frames_.back());
+        frames_.pop_back();
+        if (frames_.back().depth < depth) {
+            frames_.push_back(Frame{depth, BranchNode::createBranchNode()});
+        }
+        attachClosedFrame(frames_.back(), std::move(closed));
+    }
+}
+
+void TreeBuilder::attachPendingLeaf(Frame& parent) {
+    if (pendingKey_.size() == parent.depth) {
+        parent.node->setLeaf(pendingKey_, pendingValue_);
+        return;
+    }
+    std::unique_ptr<Node> leaf = std::make_unique<HashOfLeaf>();
+    static_cast<HashOfLeaf*>(leaf.get())->updateHash(pendingKey_, pendingValue_);
+    leaf->setExtension(ByteSequence{pendingKey_.begin() + parent.depth + 1, pendingKey_.end()});
+    parent.node->swapNodeAtChild(pendingKey_[parent.depth], leaf);
+}
+
+void TreeBuilder::attachClosedFrame(Frame& parent, Frame&& child) {
+    // both paths are prefixes of the pending key
+    auto childByte = pendingKey_[parent.depth];
+    auto dbKeyEnd = pendingKey_.begin() + parent.depth + 1;
+    child.node->setExtension(ByteSequence{dbKeyEnd, pendingKey_.begin() + child.depth});
+    child.node->computeHash(tree_.branchHashing_);
+    auto hashOfBranch = child.node->createHashOfBranchForThisNode();
+    std::memcpy(hashOfBranch->getMutableHash(), child.node->hash(), SHA256_DIGEST_LENGTH);
+    static_cast<HashOfBranch*>(hashOfBranch.get())->setDirty(false);
+    parent.node->swapNodeAtChild(childByte, hashOfBranch);
+    tree_.emplaceBranchNode(ByteSequenceView{pendingKey_.begin(), dbKeyEnd}, std::move(child.node));
+}
+
+Tree TreeBuilder::finish() {
+    if (hasPending_) {
+        closeFramesAbove(0);
+        hasPending_ = false;
+    }
+    assert(frames_.size() == 1);
+    tree_.root_ = std::move(frames_.back().node);
+    tree_.root_->computeHash(tree_.branchHashing_);
+    tree_.rootDirty_ = false;
+    frames_.clear();
+    return std::move(tree_);
+}
+
+Tree TreeBuilder::buildParallel(KeyValues&& kvs, size_t numThreads,
+                                Tree::BranchHashing branchHashing) {
+    // partitions[0] holds the empty key, partitions[b + 1] the keys starting with b.
+    constexpr size_t kNumPartitions = BranchNode::kBranchingFactor + 1;
+    std::vector<KeyValues> partitions(kNumPartitions);
+    {
+        std::vector<size_t> counts(kNumPartitions, 0);
+        for (const auto& kv : kvs) {
+            ++counts[kv.first.empty() ? 0 : kv.first[0] + 1];
+        }
+        for (size_t i = 0; i < kNumPartitions; ++i) {
+            partitions[i].reserve(counts[i]);
+        }
+        for (auto& kv : kvs) {
+            auto& partition = partitions[kv.first.empty() ? 0 : kv.first[0] + 1];
+            partition.push_back(std::move(kv));
+        }
+        kvs.clear();
+    }
+
+    std::vector<Tree> subtrees(kNumPartitions);
+    {
+        ThreadPool pool(numThreads);
+        // biggest partitions first so a large one does not end up last on a busy pool.
+        std::vector<size_t> order(kNumPartitions);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+            return partitions[lhs].size() > partitions[rhs].size();
+        });
+        std::vector<std::future<void>> pending;
+        for (auto i : order) {
+            if (partitions[i].empty()) {
+                break;
+            }
+            pending.push_back(pool.submit([&partition = partitions[i], &subtree = subtrees[i],
+                                           branchHashing] {
+                // stable so that the last occurrence of a repeated key is added last and wins
+                std::stable_sort(
+                    partition.begin(), partition.end(),
+                    [](const auto& lhs, const auto& rhs) { return LessThan{}(lhs.first, rhs.first); });
+                TreeBuilder builder(branchHashing);
+                for (const auto& [key, value] : partition) {
+                    [[maybe_unused]] bool added = builder.add(key, value);
+                    assert(added);
+                }
+                KeyValues{}.swap(partition);
+                subtree = builder.finish();
+            }));
+        }
+        for (auto& future : pending) {
+            future.get();
+        }
+    }
+
+    // Each subtree has a single child under its root, at the byte of its partition. The
+    // partitions are visited in key order so the node db is filled by appending at its end.
+    Tree tree(branchHashing);
+    for (size_t i = 0; i < kNumPartitions; ++i) {
+        auto& subtree = subtrees[i];
+        if (i == 0) {
+            auto& leaf = subtree.root_->getChildAt(BranchNode::LeafChildPos);
+            if (leaf != nullptr) {
+                std::unique_ptr<Node> moved;
+                subtree.root_->swapNodeAtChild(BranchNode::LeafChildPos, moved);
+                tree.root_->swapNodeAtChild(BranchNode::LeafChildPos, moved);
+            }
+            continue;
+        }
+        auto byte = static_cast<Byte>(i - 1);
+        if (subtree.root_->getChildAt(byte) == nullptr) {
+            continue;
+        }
+        std::unique_ptr<Node> child;
+        subtree.root_->swapNodeAtChild(byte, child);
+        tree.root_->swapNodeAtChild(byte, child);
+        while (!subtree.db_.empty()) {
+            tree.db_.insert(tree.db_.end(), subtree.db_.extract(subtree.db_.begin()));
+        }
+    }
+    tree.root_->computeHash(branchHashing);
+    tree.rootDirty_ = false;
+    return tree;
+}
+
+};  // namespace merkle
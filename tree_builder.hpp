@@ -0,0 +1,59 @@
+#include <thread>
+#include <vector>
+
+#include "tree.hpp"
+
+#pragma once
+
+namespace merkle {
+
+// Builds a tree bottom-up from key/value pairs given in increasing key order. A BranchNode is
+// hashed and written to the tree's node db as soon as the input moves past its key range, so
+// only the branch nodes on the path of the last key are held open and every node is created
+// exactly once. The result is identical to inserting the same pairs one by one and calling
+// calculateHash.
+class TreeBuilder {
+   public:
+    explicit TreeBuilder(Tree::BranchHashing branchHashing = Tree::BranchHashing::flat);
+
+    // Keys must not decrease (LessThan), adding the last key again replaces its value. false
+    // when key is below the last one, the pair is then left out and the builder goes on as if it
+    // was never given.
+    bool add(ByteSequenceView key, ByteSequenceView value);
+
+    // Closes the open branch nodes, hashes the root and hands over the tree.
+    Tree finish();
+
+    size_t size() const { return numKeys_; }
+
+    using KeyValues = std::vector<std::pair<ByteSequence, ByteSequence>>;
+
+    // Builds a tree from pairs in any order. The pairs are partitioned by their first byte, which
+    // is the child of the root they end up under, each partition is sorted and built on its own
+    // thread and the subtrees are then moved under a single root, which is hashed last. When a
+    // key appears more than once the last occurrence wins.
+    static Tree buildParallel(KeyValues&& kvs,
+                              size_t numThreads = std::thread::hardware_concurrency(),
+                              Tree::BranchHashing branchHashing = Tree::BranchHashing::flat);
+
+   private:
+    // A branch node whose key range is still open. depth is the length of its full path, i.e.
+    // its db key followed by its extension, which is always a prefix of the pending key.
+    struct Frame {
+        size_t depth;
+        std::unique_ptr<BranchNode> node;
+    };
+
+    void closeFramesAbove(size_t depth);
+    void attachPendingLeaf(Frame& parent);
+    void attachClosedFrame(Frame& parent, Frame&& child);
+
+    Tree tree_;
+    std::vector<Frame> frames_;
+    ByteSequence pendingKey_;
+    ByteSequence pendingValue_;
+    bool hasPending_ = false;
+    size_t numKeys_ = 0;
+};
+
+};  // namespace merkle